@@ -20,6 +20,8 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <limits.h>
+#include <inttypes.h>
 #include <freertos/FreeRTOS.h>
 #include <freertos/task.h>
 #include <freertos/event_groups.h>
@@ -27,36 +29,185 @@
 #include <esp_system.h>
 #include <esp_err.h>
 #include <esp_event.h>
+#include <esp_timer.h>
+#include <esp_cpu.h>
 #include <math.h>
 
 #if defined(CONFIG_BLINKEN_GAS)
 #include "gassens.h"
 #endif // defined(CONFIG_BLINKEN_GAS)
 
+#if defined(CONFIG_BLINKEN_GRADE)
+#include "grade.h"
+#endif // defined(CONFIG_BLINKEN_GRADE)
+
 #include "klist.h"
+#include "kref.h"
 #include "ws2812.h"
 #include "blinken.h"
 #include "control.h"
 
+#include "gamma16.h"
+#if defined(CONFIG_BLINKEN_GAMMA_18)
+#include "gamma_18.h"
+#define gamma_tbl   gamma_18
+#define gamma16_tbl gamma16_18
+#elif defined(CONFIG_BLINKEN_GAMMA_28)
+#include "gamma_28.h"
+#define gamma_tbl   gamma_28
+#define gamma16_tbl gamma16_28
+#else
 #include "gamma_23.h"
 #define gamma_tbl   gamma_23
+#define gamma16_tbl gamma16_23
+#endif
 
 static const char *TAG = "BLINK";
 
 struct blinken_cfg *strip_cfg;
-static ws2812_t *ws2812_cfg = NULL;
-static TimerHandle_t refresh_timer = NULL;
-static SemaphoreHandle_t refresh_sema;
 
-static SemaphoreHandle_t cb_sema;
-KLIST_HEAD(cb_list);
+/* flash partition holding the per LED colour calibration */
+#define CALIB_PARTITION     "ledcal"
+
+/* the LED outputs must keep off the IR remote control's RMT channels */
+#if defined(CONFIG_BLINKEN_RMT) && defined(CONFIG_WS2812_BACKEND_RMT) \
+    && (CONFIG_WS2812_RMT_CHANNEL == CTRL_RMT_TX_CHANNEL \
+        || CONFIG_WS2812_RMT_CHANNEL == CTRL_RMT_RX_CHANNEL)
+#error "CONFIG_WS2812_RMT_CHANNEL is used by the IR remote control"
+#endif
+
+#if defined(CONFIG_BLINKEN_RMT) && defined(CONFIG_BLINKEN_OUTPUT2) \
+    && (CONFIG_BLINKEN_OUTPUT2_RMT_CHANNEL == CTRL_RMT_TX_CHANNEL \
+        || CONFIG_BLINKEN_OUTPUT2_RMT_CHANNEL == CTRL_RMT_RX_CHANNEL)
+#error "CONFIG_BLINKEN_OUTPUT2_RMT_CHANNEL is used by the IR remote control"
+#endif
+
+/* LED outputs, each one showing a slice of the frame buffer */
+struct blinken_output {
+    ws2812_t *ws2812;
+    unsigned int offset;        // first LED of the slice
+#if defined(CONFIG_BLINKEN_GRADE)
+    uint8_t grade_lut[256];     // value mapping for grade_frame()
+    unsigned int grade_bright;  // brightness grade_lut was built for
+#endif
+};
+
+#define MAX_OUTPUTS         2
+static struct blinken_output outputs[MAX_OUTPUTS];
+static unsigned int num_outputs = 0;
+
+/*
+ * Frames are rendered for the refresh tick they will be shown at. In smooth
+ * mode, one more frame is kept ready, so a slow render does not make the
+ * next refresh miss.
+ */
+#if defined(CONFIG_BLINKEN_SCHED_SMOOTH)
+#define FRAMES_AHEAD        2
+#else
+#define FRAMES_AHEAD        1
+#endif
+
+struct blinken_frame {
+    tx_buffer_t *buffers[MAX_OUTPUTS];
+    uint64_t present;           // refresh time the frame was rendered for
+};
+
+static struct blinken_frame frames[FRAMES_AHEAD];
+static unsigned int frame_head = 0;
+static unsigned int frames_pending = 0;
+static uint32_t frame_period;  // us
+static struct blinken_frame_stats frame_stats;
+static uint64_t last_wake;
+static uint64_t frame_vsync;   // time of the last refresh tick
+
+/*
+ * Signature of the last frame encoded. Identical frames are not sent again,
+ * apart from a periodic refresh in case an LED lost its data.
+ */
+#if defined(CONFIG_BLINKEN_STATIC_SKIP)
+static uint32_t last_signature;
+static uint64_t last_encoded;
+#endif
+
+/*
+ * Earliest time the filter tree needs to run again. Events and config
+ * changes may alter the filters' state, so they reset it.
+ */
+#if defined(CONFIG_BLINKEN_EVENT_WAKEUP)
+static uint64_t render_wake = FILTER_WAKE_NOW;
+
+/*
+ * Set while idle_sleep() waits on the event queue with the refresh timer
+ * stopped. blinken_set_config() then posts an EVNT_NONE to wake it; the
+ * task notification is left alone, it carries the refresh tick's time.
+ */
+static atomic_bool render_idle = false;
+#endif
+
+/*
+ * The refresh timer notifies the render task directly, passing the lower 32
+ * bits of the tick's timestamp as notification value.
+ */
+static esp_timer_handle_t refresh_timer = NULL;
+static TaskHandle_t render_task = NULL;
+
+/* worst case time to send one LED's data and the reset pulse */
+#define LED_TIME_US         30
+#define LED_TIME_RGBW_US    40
+#define RESET_TIME_US       300
+
 struct event_cb {
-    struct klist_head list;
     event_cb_fn func;
     void *priv;
+    const enum ctrl_event_type *events;
+    int prio;
+};
+
+/*
+ * Registered call-backs, kept in immutable arrays. Registering copies the
+ * current array with the new entry appended and posts the copy in
+ * cb_posted, where the render task swaps it out without taking any lock.
+ * cb_sema only serialises registrations. An array is freed once neither
+ * the registry nor the render task refer to it.
+ */
+struct cb_array {
+    struct kref ref;
+    unsigned int len;
+    struct event_cb cbs[];
+};
+
+static SemaphoreHandle_t cb_sema;
+static struct cb_array *cb_registry = NULL;         // newest, under cb_sema
+static _Atomic(struct cb_array *) cb_posted = NULL; // not picked up yet
+static struct cb_array *cb_render = NULL;           // render task's copy
+
+/*
+ * Event dispatch table. The handlers for event type e are
+ * event_subs[event_first[e]] up to event_subs[event_first[e + 1] - 1],
+ * sorted by priority. It is rebuilt when the filter tree or the call-back
+ * list changes. Without a table, events travel down the filter tree.
+ */
+#define EVENT_SUB_CB        (1 << 0)
+
+struct event_sub {
+    union {
+        event_fn filter;
+        event_cb_fn cb;
+    } fn;
+    void *ctx;                  // the filter or the call-back's priv
+    int16_t prio;
+    uint8_t flags;
 };
 
-hsv_value_t hsv_buffer[CONFIG_WS2812_MAX_LEDS];
+static struct event_sub *event_subs = NULL;
+static uint16_t event_first[EVNT_MAX + 1];
+static uint16_t event_fill[EVNT_MAX];
+static bool events_dirty = true;
+
+#if defined(CONFIG_BLINKEN_PROFILE)
+/* set when the filter tree changes, so new filters get their counters */
+static bool prof_dirty = true;
+#endif
 
 esp_err_t filter_set_parent(struct led_filter *child,
                             struct led_filter *parent)
@@ -72,6 +223,10 @@ esp_err_t filter_set_parent(struct led_filter *child,
 
     child->parent = parent;
     klist_add_tail(&child->siblings, &parent->children);
+    events_dirty = true;
+#if defined(CONFIG_BLINKEN_PROFILE)
+    prof_dirty = true;
+#endif
 
 on_exit:
     return result;
@@ -89,6 +244,10 @@ esp_err_t filter_unset_parent(struct led_filter *child)
 
     klist_del_init(&child->siblings);
     child->parent = NULL;
+    events_dirty = true;
+#if defined(CONFIG_BLINKEN_PROFILE)
+    prof_dirty = true;
+#endif
 
 on_exit:
     return result;
@@ -105,6 +264,20 @@ void update_child_filters(struct led_filter *this,
     }
 }
 
+#if defined(CONFIG_BLINKEN_PROFILE)
+/* give this filter and all below it a profiling counter */
+static void register_filter_profs(struct led_filter *this)
+{
+    struct led_filter *child;
+
+    blinken_prof_register(&this->prof, this->name);
+
+    klist_for_each_entry(child, &(this->children), siblings){
+        register_filter_profs(child);
+    }
+}
+#endif
+
 void run_child_filters(struct led_filter *this,
                         void *state_ptr,
                         hsv_value_t leds[],
@@ -113,23 +286,91 @@ void run_child_filters(struct led_filter *this,
                         uint64_t now)
 {
     struct led_filter *child;
+    uint32_t start;
 
     klist_for_each_entry(child, &(this->children), siblings){
+        filter_reset_wake(child);
+        start = PROF_BEGIN();
         child->filter(child, state_ptr, leds, num_leds, offset, now);
+        PROF_END(&child->prof, start);
+        this->child_wake = min(this->child_wake, child->wake);
     }
 }
 
+void run_child_filters_rgb(struct led_filter *this,
+                           void *state_ptr,
+                           rgb_value_t leds[],
+                           unsigned int num_leds,
+                           unsigned int offset,
+                           uint64_t now)
+{
+    struct led_filter *child;
+    uint32_t start;
+
+    klist_for_each_entry(child, &(this->children), siblings){
+        filter_reset_wake(child);
+        start = PROF_BEGIN();
+        child->filter_rgb(child, state_ptr, leds, num_leds, offset, now);
+        PROF_END(&child->prof, start);
+        this->child_wake = min(this->child_wake, child->wake);
+    }
+}
+
+/*
+ * Report the earliest time the filter's output may change, including
+ * that of any children it has run. Usually this->child_wake or earlier.
+ */
+void filter_set_wake(struct led_filter *this, uint64_t wake)
+{
+    this->wake = wake;
+}
+
+/*
+ * Called before running a filter. Unless it says otherwise, the filter
+ * is run again for the next frame.
+ */
+void filter_reset_wake(struct led_filter *this)
+{
+    this->wake = FILTER_WAKE_NOW;
+    this->child_wake = FILTER_WAKE_NEVER;
+}
+
 struct strip_handler
 {
     void *state_ptr;
     struct led_filter *filter_root;
     hsv_value_t *hsv_vals;
+    rgb_value_t *rgb_vals;
+#if defined(CONFIG_BLINKEN_GRADE)
+    rgb_value_t *graded_vals;
+#endif
     volatile size_t strip_len;
     volatile uint32_t brightness;
 };
 
 struct strip_handler handler;
 
+/*
+ * Config hand-over between the render task and the rest of the world.
+ * Each buffer is guarded by a sequence counter that is odd while it is
+ * being written, so readers take a consistent copy without locking.
+ * blinken_set_config() posts to cfg_request, the render task applies it
+ * at the next frame boundary and publishes the result in cfg_active.
+ * cfg_sema only keeps concurrent blinken_set_config() calls apart.
+ */
+struct cfg_seqbuf {
+    atomic_uint seq;
+    uint64_t posted;            // time of blinken_set_config()
+    struct blinken_cfg cfg;
+};
+
+static struct cfg_seqbuf cfg_request;
+static struct cfg_seqbuf cfg_active;
+static unsigned int cfg_applied_seq = 0;
+
+/* reading tasks give the writer this many chances before backing off */
+#define CFG_READ_TRIES      4
+
 SemaphoreHandle_t cfg_sema = NULL;
 
 void filter_deinit(struct led_filter *this)
@@ -151,6 +392,7 @@ void filter_deinit(struct led_filter *this)
         free(priv);
     }
     this->filter = NULL;
+    this->filter_rgb = NULL;
     this->name = NULL;
     this->init = NULL;
 }
@@ -160,6 +402,11 @@ int forward_event(struct led_filter *this, void *state, struct ctrl_event *evt)
     struct led_filter *child;
     int handled;
 
+    /* the children have table entries of their own */
+    if(event_subs != NULL){
+        return 0;
+    }
+
     handled = 0;
     klist_for_each_entry(child, &(this->children), siblings){
         if(child->event != NULL){
@@ -174,15 +421,27 @@ int forward_event(struct led_filter *this, void *state, struct ctrl_event *evt)
     return handled;
 }
 
-/* let other modules register call-back functions for control events. */
-esp_err_t register_event_cb(event_cb_fn func, void *priv)
+static void cb_array_release(struct kref *ref)
 {
+    free(container_of(ref, struct cb_array, ref));
+}
+
+/*
+ * Let other modules register call-back functions for control events. The
+ * call-back gets the event types listed in events, terminated by EVNT_NONE,
+ * or all of them if events is NULL.
+ */
+esp_err_t register_event_cb_for(event_cb_fn func, void *priv,
+                                const enum ctrl_event_type events[],
+                                int prio)
+{
+    struct cb_array *arr, *old;
+    struct event_cb *cb;
+    unsigned int len;
     esp_err_t result;
     BaseType_t status;
-    struct event_cb *cb;
 
     result = ESP_OK;
-    cb = NULL;
 
     if(func == NULL){
         ESP_LOGE(TAG, "Refusing to register NULL call-back fn");
@@ -190,14 +449,7 @@ esp_err_t register_event_cb(event_cb_fn func, void *priv)
         goto err_out;
     }
 
-    cb = malloc(sizeof(*cb));
-    if(cb == NULL){
-        ESP_LOGE(TAG, "Out of memory for call-back registration");
-        result = ESP_ERR_NO_MEM;
-        goto err_out;
-    }
-
-    /* make sure we have exclusive access to the call-back list */
+    /* make sure no other registration gets in between */
     status = xSemaphoreTake(cb_sema, portMAX_DELAY);
     if(status != pdTRUE){
         ESP_LOGE(TAG, "[%s] Timeout waiting for call-back sema.\n", __func__);
@@ -205,43 +457,110 @@ esp_err_t register_event_cb(event_cb_fn func, void *priv)
         goto err_out;
     }
 
-    /* initialise call-back entry struct and append it to the list */
-    INIT_KLIST_HEAD(&cb->list);
+    len = (cb_registry != NULL) ? cb_registry->len : 0;
+
+    arr = malloc(sizeof(*arr) + (len + 1) * sizeof(arr->cbs[0]));
+    if(arr == NULL){
+        ESP_LOGE(TAG, "Out of memory for call-back registration");
+        result = ESP_ERR_NO_MEM;
+        goto err_unlock;
+    }
+
+    /* copy the current call-backs and append the new one */
+    if(len > 0){
+        memcpy(arr->cbs, cb_registry->cbs, len * sizeof(arr->cbs[0]));
+    }
+
+    cb = &arr->cbs[len];
     cb->func = func;
     cb->priv = priv;
-    klist_add_tail(&cb->list, &cb_list);
+    cb->events = events;
+    cb->prio = prio;
+    arr->len = len + 1;
+
+    /* one reference for the registry, one for the render task */
+    kref_init(&arr->ref);
+    kref_get(&arr->ref);
+
+    old = atomic_exchange(&cb_posted, arr);
+    if(old != NULL){
+        kref_put(&old->ref, cb_array_release);
+    }
+
+    if(cb_registry != NULL){
+        kref_put(&cb_registry->ref, cb_array_release);
+    }
+    cb_registry = arr;
 
-    /* release lock on call-back list. */
+err_unlock:
     (void) xSemaphoreGive(cb_sema);
 
 err_out:
-    if(result != ESP_OK && cb != NULL){
-        free(cb);
+    return result;
+}
+
+esp_err_t register_event_cb(event_cb_fn func, void *priv)
+{
+    return register_event_cb_for(func, priv, NULL, EVENT_PRIO_CB);
+}
+
+/* check whether an EVNT_NONE terminated list holds type, NULL means all */
+static bool event_listed(const enum ctrl_event_type *events,
+                         enum ctrl_event_type type)
+{
+    if(events == NULL){
+        return true;
     }
 
-    return result;
+    for(; *events != EVNT_NONE; ++events){
+        if(*events == type){
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/*
+ * Switch the render task to the latest call-back array, if one has been
+ * posted since the last call. Returns true if the call-backs changed.
+ */
+static bool update_cb_array(void)
+{
+    struct cb_array *arr;
+
+    arr = atomic_exchange(&cb_posted, NULL);
+    if(arr == NULL){
+        return false;
+    }
+
+    if(cb_render != NULL){
+        kref_put(&cb_render->ref, cb_array_release);
+    }
+    cb_render = arr;
+
+    return true;
 }
 
 /* run registered call-backs for unhandled events. */
 static int run_event_cb(struct ctrl_event *evt)
 {
-    int result;
-    BaseType_t status;
     struct event_cb *cb;
+    unsigned int idx;
+    int result;
 
     result = 0;
-    cb = NULL;
-
-    /* get exclusive access to list of call-backs. */
-    status = xSemaphoreTake(cb_sema, portMAX_DELAY);
-    if(status != pdTRUE){
-        ESP_LOGE(TAG, "[%s] Timeout waiting for call-back sema.\n", __func__);
-        result = ESP_ERR_TIMEOUT;
+    if(cb_render == NULL){
         goto err_out;
     }
 
     /* execute call-backs in list until one was able to handle the event. */
-    klist_for_each_entry(cb, &cb_list, list){
+    for(idx = 0; idx < cb_render->len; ++idx){
+        cb = &cb_render->cbs[idx];
+        if(!event_listed(cb->events, evt->event)){
+            continue;
+        }
+
         result = cb->func(evt, cb->priv);
         if(result != 0){
             /* call-back was able to handle event. Exit loop.*/
@@ -249,160 +568,1113 @@ static int run_event_cb(struct ctrl_event *evt)
         }
     }
 
-    /* release lock on call-back list.*/
-    (void) xSemaphoreGive(cb_sema);
-
 err_out:
     return result;
-
 }
-int __attribute__((weak)) config_override(struct blinken_cfg *cfg)
+
+/* brightness control for events no filter has handled */
+static int builtin_event(struct ctrl_event *evt, void *priv __maybe_unused)
 {
-    ESP_LOGE(TAG, "[%s] Called.", __func__);
+    int handled;
 
-    return 0;
+    handled = 0;
+    switch(evt->event){
+    case EVNT_VOLUP:
+        strip_cfg->brightness += HSV_VAL_MAX / 20;
+        if(strip_cfg->brightness > HSV_VAL_MAX){
+            strip_cfg->brightness = HSV_VAL_MAX;
+        }
+        handled = 1;
+        break;
+    case EVNT_VOLDOWN:
+        if(strip_cfg->brightness >= HSV_VAL_MAX / 20){
+            strip_cfg->brightness -= HSV_VAL_MAX / 20;
+        } else {
+            strip_cfg->brightness = 0;
+        }
+        handled = 1;
+        break;
+    default:
+        break;
+    }
+
+    return handled;
 }
 
-static esp_err_t init_handler(struct strip_handler *this,
-                              struct blinken_cfg *cfg,
-                              ws2812_t *ws2812,
-                              bool update)
-{
-    BaseType_t status;
-    struct led_filter *filter;
-    esp_err_t result;
+static const enum ctrl_event_type builtin_events[] = {
+    EVNT_VOLUP,
+    EVNT_VOLDOWN,
+    EVNT_NONE
+};
 
-    result = ESP_OK;
+/*
+ * Count an entry for every listed event type or, once event_subs has been
+ * allocated, store it in the next free slot of that type.
+ */
+static void add_event_sub(struct event_sub *subs,
+                          const enum ctrl_event_type *events,
+                          const struct event_sub *sub)
+{
+    unsigned int type;
 
-    (void) config_override(cfg);
+    for(type = EVNT_NONE + 1; type < EVNT_MAX; ++type){
+        if(!event_listed(events, type)){
+            continue;
+        }
 
-    if(cfg->strip_len > MAX_STRIP_LEN){
-        ESP_LOGE(TAG, "[%s] Invalid strip_len found: %d.",
-                    __func__, cfg->strip_len);
-        cfg->strip_len = MAX_STRIP_LEN;
+        if(subs != NULL){
+            subs[event_fill[type]] = *sub;
+        }
+        ++event_fill[type];
     }
+}
 
-    if(cfg->refresh < MIN_STRIP_REFRESH){
-        ESP_LOGE(TAG, "[%s] Refresh rate too low: %d.",
-                    __func__, cfg->refresh);
-        cfg->refresh = MIN_STRIP_REFRESH;
+/*
+ * Every filter with an event handler gets its entries, wherever it sits in
+ * the tree. Filters without one, like plain layers, are only passed through.
+ */
+static void add_filter_subs(struct event_sub *subs, struct led_filter *this)
+{
+    struct led_filter *child;
+    struct event_sub sub;
+
+    if(this->event != NULL){
+        sub.fn.filter = this->event;
+        sub.ctx = this;
+        sub.prio = this->event_prio;
+        sub.flags = 0;
+        add_event_sub(subs, this->events, &sub);
     }
 
-    if(cfg->refresh > MAX_STRIP_REFRESH){
-        ESP_LOGE(TAG, "[%s] Refresh rate too high: %d.",
-                    __func__, cfg->refresh);
-        cfg->refresh = MAX_STRIP_REFRESH;
+    klist_for_each_entry(child, &(this->children), siblings){
+        add_filter_subs(subs, child);
     }
+}
 
-    if(cfg->brightness > HSV_VAL_MAX){
-        ESP_LOGE(TAG, "[%s] Brightness too high: %d.",
-                    __func__, cfg->brightness);
-        cfg->brightness = HSV_VAL_MAX;
+static void add_all_subs(struct event_sub *subs, struct led_filter *root)
+{
+    struct event_cb *cb;
+    struct event_sub sub;
+    unsigned int idx;
+
+    add_filter_subs(subs, root);
+
+    sub.fn.cb = builtin_event;
+    sub.ctx = NULL;
+    sub.prio = EVENT_PRIO_BUILTIN;
+    sub.flags = EVENT_SUB_CB;
+    add_event_sub(subs, builtin_events, &sub);
+
+    for(idx = 0; cb_render != NULL && idx < cb_render->len; ++idx){
+        cb = &cb_render->cbs[idx];
+        sub.fn.cb = cb->func;
+        sub.ctx = cb->priv;
+        sub.prio = cb->prio;
+        add_event_sub(subs, cb->events, &sub);
     }
+}
 
-    this->strip_len = cfg->strip_len;
-    this->brightness = cfg->brightness;
-    this->hsv_vals = hsv_buffer;
+/* collect all handlers in two passes, then sort each type's by priority */
+static void build_event_table(struct led_filter *root)
+{
+    struct event_sub *subs, tmp;
+    unsigned int type, i, j;
 
-    result = ws2812_set_len(ws2812, this->strip_len);
-    if(result != ESP_OK){
-        ESP_LOGE(TAG, "[%s] ws2812_set_len() failed.", __func__);
-        goto err_out;
+    free(event_subs);
+    event_subs = NULL;
+
+    memset(event_fill, 0x0, sizeof(event_fill));
+    add_all_subs(NULL, root);
+
+    event_first[0] = 0;
+    for(type = 0; type < EVNT_MAX; ++type){
+        event_first[type + 1] = event_first[type] + event_fill[type];
+        event_fill[type] = event_first[type];
     }
 
-    status = xTimerChangePeriod(refresh_timer,
-                                pdMS_TO_TICKS(1000) / cfg->refresh,
-                                portMAX_DELAY);
-    if(status == pdFAIL){
-        ESP_LOGE(TAG, "[%s] Setting refresh rate failed.", __func__);
-        result = ESP_FAIL;
+    /* one spare entry, so an empty table is not mistaken for none at all */
+    subs = malloc((event_first[EVNT_MAX] + 1) * sizeof(*subs));
+    if(subs == NULL){
+        ESP_LOGE(TAG, "[%s] Out of memory, dispatching through filter tree.",
+                 __func__);
         goto err_out;
     }
 
-    if(update){
-        result = this->filter_root->init(this->filter_root, cfg, true, NULL);
-        if(result != ESP_OK){
-            ESP_LOGE(TAG, "[%s] updating filter %s failed.\n", __func__,
-                    filter->name != NULL ? filter->name : "unknown");
-            goto err_out;
+    add_all_subs(subs, root);
+
+    /* stable insertion sort, equal priorities keep tree and list order */
+    for(type = 0; type < EVNT_MAX; ++type){
+        for(i = event_first[type] + 1; i < event_first[type + 1]; ++i){
+            tmp = subs[i];
+            for(j = i; j > event_first[type] && subs[j - 1].prio > tmp.prio;
+                --j)
+            {
+                subs[j] = subs[j - 1];
+            }
+            subs[j] = tmp;
         }
     }
 
+    event_subs = subs;
+
 err_out:
-    return result;
+    events_dirty = false;
 }
 
-esp_err_t blinken_get_config(struct blinken_cfg *cfg)
+static int dispatch_event(struct led_filter *root, struct ctrl_event *evt)
 {
-    BaseType_t status;
+    struct event_sub *sub, *end;
+    int handled;
 
-    if(cfg == NULL){
-        return ESP_ERR_INVALID_ARG;
-    }
+    if(event_subs == NULL || evt->event >= EVNT_MAX){
+        handled = 0;
+        if(root->event != NULL){
+            handled = root->event(root, handler.state_ptr, evt);
+        }
 
-    if(strip_cfg == NULL){
-        return ESP_ERR_INVALID_STATE;
-    }
+        if(handled == 0){
+            handled = builtin_event(evt, NULL);
+        }
 
-    status = xSemaphoreTake(cfg_sema, portMAX_DELAY);
-    if(status != pdTRUE){
-        ESP_LOGE(TAG, "[%s] Timeout waiting for config sema.\n", __func__);
-        return ESP_ERR_TIMEOUT;
+        if(handled == 0){
+            handled = run_event_cb(evt);
+        }
+
+        return handled;
     }
 
-    memmove(cfg, strip_cfg, sizeof(*cfg));
+    handled = 0;
+    end = &event_subs[event_first[evt->event + 1]];
+    for(sub = &event_subs[event_first[evt->event]]; sub < end; ++sub){
+        if(sub->flags & EVENT_SUB_CB){
+            handled = sub->fn.cb(evt, sub->ctx);
+        } else {
+            handled = sub->fn.filter(sub->ctx, handler.state_ptr, evt);
+        }
 
-    xSemaphoreGive(cfg_sema);
+        if(handled != 0){
+            break;
+        }
+    }
 
-    return ESP_OK;
+    return handled;
 }
 
-esp_err_t blinken_set_config(struct blinken_cfg *cfg)
+/*
+ * Dispatch all events waiting in the queue, returns how many there were.
+ * The slowest dispatch is kept in the frame statistics.
+ */
+static unsigned int handle_events(struct led_filter *root,
+                                  QueueHandle_t evt_queue)
 {
-    esp_err_t result;
-    BaseType_t status;
+    struct ctrl_event evt;
+    unsigned int count;
+    uint32_t start, cycles;
+    int evt_handled;
 
-    result = 0;
-    if(cfg == NULL){
-        result = ESP_ERR_INVALID_ARG;
-        goto err_out;
-    }
+    count = 0;
+    while(xQueueReceive(evt_queue, &evt, 0) == pdTRUE){
+        /* only wakes the render task, see blinken_set_config() */
+        if(evt.event == EVNT_NONE){
+            ++count;
+            continue;
+        }
 
-    status = xSemaphoreTake(cfg_sema, portMAX_DELAY);
-    if(status != pdTRUE){
-        ESP_LOGE(TAG, "[%s] Timeout waiting for config sema.\n", __func__);
-        result = ESP_ERR_TIMEOUT;
-        goto err_out;
-    }
+        start = esp_cpu_get_ccount();
+        evt_handled = dispatch_event(root, &evt);
+        cycles = esp_cpu_get_ccount() - start;
 
-    result = init_handler(&handler, cfg, ws2812_cfg, true);
-    if(result == ESP_OK){
-        memmove(strip_cfg, cfg, sizeof(*strip_cfg));
+        frame_stats.dispatch_max = max(frame_stats.dispatch_max, cycles);
+        ++frame_stats.events;
+        ++count;
+
+        if(evt_handled == 0){
+            ESP_LOGW(TAG, "[%s] Unhandled control event 0x%x.",
+                __func__, evt.event);
+        }
     }
 
-    xSemaphoreGive(cfg_sema);
+    return count;
+}
 
-err_out:
-    return result;
+int __attribute__((weak)) config_override(struct blinken_cfg *cfg)
+{
+    ESP_LOGE(TAG, "[%s] Called.", __func__);
+
+    return 0;
 }
 
-static void timer_cb(TimerHandle_t timer __attribute__((unused)))
+/* number of LEDs from the frame buffer shown on an output */
+static size_t output_len(struct blinken_output *out, size_t strip_len)
 {
-    (void) xSemaphoreGive(refresh_sema);
+    if(strip_len <= out->offset){
+        return 0;
+    }
+
+    return min(strip_len - out->offset, out->ws2812->max_len);
 }
 
-void run_strip(void)
+/* time in us it takes to send len LEDs of the given type */
+static uint32_t output_time(enum pixel_type type, size_t len)
 {
-    QueueHandle_t evt_queue;
-    struct ctrl_event evt;
-    struct led_filter *root;
-    tx_buffer_t *buffer;
-    unsigned int idx, brightness;
+#if defined(CONFIG_BLINKEN_TYPE_APA102)
+    uint64_t bits;
+
+    /* start frame, 4 bytes per LED and end frame, all at the SPI clock */
+    if(type == pixel_apa102){
+        bits = (uint64_t) ws2812_dmabuf_len(type, len) * 8;
+        return (bits * 1000000 + CONFIG_APA102_CLOCK_FREQ - 1)
+               / CONFIG_APA102_CLOCK_FREQ;
+    }
+#endif
+
+    return len * (type == pixel_rgbw ? LED_TIME_RGBW_US : LED_TIME_US)
+           + RESET_TIME_US;
+}
+
+/*
+ * Highest refresh rate at which a whole frame still fits into a period. The
+ * outputs are sent at the same time, so the slowest one sets the limit.
+ */
+static uint32_t max_refresh(struct blinken_cfg *cfg)
+{
+    uint32_t frame_time;
+    unsigned int idx;
+
+    frame_time = 1;
+    for(idx = 0; idx < num_outputs; ++idx){
+        frame_time = max(frame_time,
+                         output_time(outputs[idx].ws2812->type,
+                                     output_len(&outputs[idx],
+                                                cfg->strip_len)));
+    }
+
+    return min(1000000 / frame_time, (uint32_t) MAX_STRIP_REFRESH);
+}
+
+/*
+ * Resize a pixel buffer holding old_len pixels of size bytes to len pixels,
+ * len 0 releases it. The contents are kept, as filters may build on their
+ * previous frame, and pixels added at the end start out dark. Only growing
+ * a buffer can fail.
+ */
+static esp_err_t resize_buffer(void **buffer, size_t old_len, size_t len,
+                               size_t size)
+{
+    uint8_t *tmp;
+
+    if(*buffer == NULL){
+        old_len = 0;
+    }
+
+    if(len == old_len){
+        return ESP_OK;
+    }
+
+    if(len == 0){
+        free(*buffer);
+        *buffer = NULL;
+        return ESP_OK;
+    }
+
+    tmp = realloc(*buffer, len * size);
+    if(tmp == NULL){
+        /* a shrinking buffer is still good for the new length */
+        return (len < old_len) ? ESP_OK : ESP_ERR_NO_MEM;
+    }
+
+    if(len > old_len){
+        memset(&tmp[old_len * size], 0x0, (len - old_len) * size);
+    }
+    *buffer = tmp;
+
+    return ESP_OK;
+}
+
+/*
+ * Size the handler's frame buffers for len pixels. Only the kind of frame
+ * the root filter renders gets a buffer, plus one for the graded frame if
+ * there is a grading LUT. Buffers are grown before any are shrunk, so on
+ * failure all of them still hold the old length.
+ */
+static esp_err_t resize_buffers(struct strip_handler *this, size_t len)
+{
+    struct led_filter *root = this->filter_root;
+    struct {
+        void **buffer;
+        size_t size;
+        bool needed;
+    } bufs[] = {
+        { (void **) &this->hsv_vals, sizeof(*this->hsv_vals),
+          root != NULL && root->filter_rgb == NULL },
+        { (void **) &this->rgb_vals, sizeof(*this->rgb_vals),
+          root != NULL && root->filter_rgb != NULL },
+#if defined(CONFIG_BLINKEN_GRADE)
+        { (void **) &this->graded_vals, sizeof(*this->graded_vals),
+          root != NULL && grade_active() },
+#endif
+    };
+    unsigned int pass, idx;
+    size_t old_len, new_len;
+    esp_err_t result;
+
+    for(pass = 0; pass < 2; ++pass){
+        for(idx = 0; idx < ARRAY_SIZE(bufs); ++idx){
+            old_len = (*bufs[idx].buffer != NULL) ? this->strip_len : 0;
+            new_len = bufs[idx].needed ? len : 0;
+
+            /* first pass grows, second one shrinks */
+            if((new_len > old_len) != (pass == 0)){
+                continue;
+            }
+
+            result = resize_buffer(bufs[idx].buffer, old_len, new_len,
+                                   bufs[idx].size);
+            if(result != ESP_OK){
+                return result;
+            }
+        }
+    }
+
+    return ESP_OK;
+}
+
+static void flush_frames(void);
+
+static esp_err_t init_handler(struct strip_handler *this,
+                              struct blinken_cfg *cfg,
+                              bool update)
+{
+    unsigned int idx;
+    uint32_t period;
+    size_t old_len;
+    esp_err_t result;
+
+    result = ESP_OK;
+
+    (void) config_override(cfg);
+
+    if(cfg->strip_len > MAX_STRIP_LEN){
+        ESP_LOGE(TAG, "[%s] Invalid strip_len found: %d.",
+                    __func__, cfg->strip_len);
+        cfg->strip_len = MAX_STRIP_LEN;
+    }
+
+    if(cfg->refresh < MIN_STRIP_REFRESH){
+        ESP_LOGE(TAG, "[%s] Refresh rate too low: %d.",
+                    __func__, cfg->refresh);
+        cfg->refresh = MIN_STRIP_REFRESH;
+    }
+
+    if(cfg->refresh > max_refresh(cfg)){
+        ESP_LOGE(TAG, "[%s] Refresh rate too high: %d.",
+                    __func__, cfg->refresh);
+        cfg->refresh = max_refresh(cfg);
+    }
+
+    if(cfg->brightness > HSV_VAL_MAX){
+        ESP_LOGE(TAG, "[%s] Brightness too high: %d.",
+                    __func__, cfg->brightness);
+        cfg->brightness = HSV_VAL_MAX;
+    }
+
+    /* on failure, keep the old length and buffers */
+    result = resize_buffers(this, cfg->strip_len);
+    if(result != ESP_OK){
+        ESP_LOGE(TAG, "[%s] Allocating frame buffers failed.", __func__);
+        cfg->strip_len = this->strip_len;
+        goto err_out;
+    }
+
+    old_len = this->strip_len;
+    this->strip_len = cfg->strip_len;
+    this->brightness = cfg->brightness;
+
+    /*
+     * The outputs only take a new length once they have all their buffers
+     * back, so the frames still waiting in the pipeline go out first.
+     */
+    if(!update || this->strip_len != old_len){
+        flush_frames();
+
+        for(idx = 0; idx < num_outputs; ++idx){
+            result = ws2812_set_len(outputs[idx].ws2812,
+                                output_len(&outputs[idx], this->strip_len));
+            if(result != ESP_OK){
+                ESP_LOGE(TAG, "[%s] ws2812_set_len() failed.", __func__);
+                goto err_out;
+            }
+        }
+    }
+
+    period = (1000000 + cfg->refresh / 2) / cfg->refresh;
+    if(period != frame_period){
+        (void) esp_timer_stop(refresh_timer);
+        result = esp_timer_start_periodic(refresh_timer, period);
+        if(result != ESP_OK){
+            ESP_LOGE(TAG, "[%s] Setting refresh rate failed.", __func__);
+            goto err_out;
+        }
+
+        frame_period = period;
+        blinken_reset_frame_stats();
+    }
+
+    if(update){
+        result = this->filter_root->init(this->filter_root, cfg, true, NULL);
+        if(result != ESP_OK){
+            ESP_LOGE(TAG, "[%s] updating filter %s failed.\n", __func__,
+                    this->filter_root->name != NULL ? this->filter_root->name
+                                                    : "unknown");
+            goto err_out;
+        }
+    }
+
+err_out:
+    return result;
+}
+
+static void cfg_write(struct cfg_seqbuf *buf, const struct blinken_cfg *cfg,
+                      uint64_t posted)
+{
+    (void) atomic_fetch_add(&buf->seq, 1);
+    atomic_thread_fence(memory_order_release);
+
+    buf->posted = posted;
+    memmove(&buf->cfg, cfg, sizeof(buf->cfg));
+
+    atomic_thread_fence(memory_order_release);
+    (void) atomic_fetch_add(&buf->seq, 1);
+}
+
+/*
+ * Take a copy of the buffer, returns false if the writer got in between.
+ * On success *seq holds the sequence number of the copy.
+ */
+static bool cfg_read(struct cfg_seqbuf *buf, struct blinken_cfg *cfg,
+                     uint64_t *posted, unsigned int *seq)
+{
+    unsigned int start;
+
+    start = atomic_load(&buf->seq);
+    if(start & 1){
+        return false;
+    }
+
+    atomic_thread_fence(memory_order_acquire);
+    memmove(cfg, &buf->cfg, sizeof(*cfg));
+    if(posted != NULL){
+        *posted = buf->posted;
+    }
+    atomic_thread_fence(memory_order_acquire);
+
+    if(atomic_load(&buf->seq) != start){
+        return false;
+    }
+
+    *seq = start;
+
+    return true;
+}
+
+esp_err_t blinken_get_config(struct blinken_cfg *cfg)
+{
+    unsigned int tries, seq;
+
+    if(cfg == NULL){
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    /* nothing published yet */
+    if(atomic_load(&cfg_active.seq) == 0){
+        return ESP_ERR_INVALID_STATE;
+    }
+
+    /*
+     * The render task may have been preempted mid-update by this one, so
+     * let it run before trying again.
+     */
+    for(tries = 0; !cfg_read(&cfg_active, cfg, NULL, &seq); ++tries){
+        if(tries >= CFG_READ_TRIES){
+            vTaskDelay(1);
+        }
+    }
+
+    return ESP_OK;
+}
+
+#if defined(CONFIG_BLINKEN_EVENT_WAKEUP)
+/* post an empty event to get the render task out of idle_sleep() */
+static void wake_render_task(void)
+{
+    struct ctrl_event evt = { .event = EVNT_NONE };
+    QueueHandle_t queue;
+
+    queue = blinken_ctrl_get_queue();
+    if(queue != NULL){
+        (void) xQueueSendToBack(queue, &evt, 0);
+    }
+}
+#endif
+
+/*
+ * Check a config before it goes to the render task, using the same limits
+ * init_handler() enforces there. config_override() gets its say first, on
+ * a copy, so only what would really be applied is judged.
+ */
+static esp_err_t check_config(const struct blinken_cfg *cfg)
+{
+    struct blinken_cfg tmp;
+    size_t capacity;
+    unsigned int idx;
+
+    tmp = *cfg;
+    (void) config_override(&tmp);
+
+    capacity = MAX_STRIP_LEN;
+    if(num_outputs > 0){
+        capacity = 0;
+        for(idx = 0; idx < num_outputs; ++idx){
+            capacity = max(capacity, outputs[idx].offset
+                                     + outputs[idx].ws2812->max_len);
+        }
+    }
+
+    if(tmp.strip_len > min(capacity, (size_t) MAX_STRIP_LEN)){
+        ESP_LOGE(TAG, "[%s] Invalid strip_len: %" PRIu32 ".",
+                 __func__, tmp.strip_len);
+        return ESP_ERR_INVALID_SIZE;
+    }
+
+    if(tmp.refresh < MIN_STRIP_REFRESH || tmp.refresh > max_refresh(&tmp)){
+        ESP_LOGE(TAG, "[%s] Invalid refresh rate: %" PRIu32 ".",
+                 __func__, tmp.refresh);
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    if(tmp.brightness > HSV_VAL_MAX){
+        ESP_LOGE(TAG, "[%s] Brightness too high: %" PRIu32 ".",
+                 __func__, tmp.brightness);
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    return ESP_OK;
+}
+
+/*
+ * Hand a new config to the render task. It is checked here and applied at
+ * the next frame boundary.
+ */
+esp_err_t blinken_set_config(struct blinken_cfg *cfg)
+{
+    esp_err_t result;
+    BaseType_t status;
+
+    result = 0;
+    if(cfg == NULL){
+        result = ESP_ERR_INVALID_ARG;
+        goto err_out;
+    }
+
+    result = check_config(cfg);
+    if(result != ESP_OK){
+        goto err_out;
+    }
+
+    status = xSemaphoreTake(cfg_sema, portMAX_DELAY);
+    if(status != pdTRUE){
+        ESP_LOGE(TAG, "[%s] Timeout waiting for config sema.\n", __func__);
+        result = ESP_ERR_TIMEOUT;
+        goto err_out;
+    }
+
+    cfg_write(&cfg_request, cfg, esp_timer_get_time());
+
+#if defined(CONFIG_BLINKEN_EVENT_WAKEUP)
+    /* idle_sleep() checks the request after setting render_idle */
+    if(atomic_load(&render_idle)){
+        wake_render_task();
+    }
+#endif
+
+    xSemaphoreGive(cfg_sema);
+
+err_out:
+    return result;
+}
+
+/* apply a config posted by blinken_set_config(), render task only */
+static bool apply_config(void)
+{
+    struct blinken_cfg cfg;
+    unsigned int seq;
+    uint64_t posted, start, end;
+    esp_err_t result;
+
+    if(atomic_load(&cfg_request.seq) == cfg_applied_seq){
+        return false;
+    }
+
+    /* never wait for the writer, try again next frame */
+    if(!cfg_read(&cfg_request, &cfg, &posted, &seq)){
+        return false;
+    }
+    cfg_applied_seq = seq;
+
+    start = esp_timer_get_time();
+    result = init_handler(&handler, &cfg, true);
+    if(result == ESP_OK){
+        memmove(strip_cfg, &cfg, sizeof(*strip_cfg));
+    } else {
+        ESP_LOGE(TAG, "[%s] Applying config failed.", __func__);
+    }
+    end = esp_timer_get_time();
+
+    frame_stats.cfg_latency_max = max(frame_stats.cfg_latency_max,
+                                      (uint32_t) (end - posted));
+    frame_stats.cfg_apply_max = max(frame_stats.cfg_apply_max,
+                                    (uint32_t) (end - start));
+
+#if defined(CONFIG_BLINKEN_EVENT_WAKEUP)
+    render_wake = FILTER_WAKE_NOW;
+#endif
+
+    return true;
+}
+
+#if defined(CONFIG_WS2812_POWER_LIMIT)
+/* share the LED current budget between the outputs by LED count */
+static void share_power_budget(void)
+{
+    unsigned int idx, total;
+
+    total = 0;
+    for(idx = 0; idx < num_outputs; ++idx){
+        total += outputs[idx].ws2812->max_len;
+    }
+
+    for(idx = 0; idx < num_outputs; ++idx){
+        (void) ws2812_set_power_budget(outputs[idx].ws2812,
+                                       CONFIG_WS2812_POWER_BUDGET_MA
+                                       * outputs[idx].ws2812->max_len / total);
+    }
+}
+#endif
+
+/* create the LED outputs and map them to the frame buffer */
+static esp_err_t init_outputs(enum pixel_type type)
+{
+#if defined(CONFIG_BLINKEN_OUTPUT2)
+    ws2812_output_t output2 = {
+        .backend = ws2812_rmt,
+        .type =
+#if defined(CONFIG_BLINKEN_OUTPUT2_RGBW)
+            pixel_rgbw,
+#elif defined(CONFIG_BLINKEN_OUTPUT2_RGB)
+            pixel_rgb,
+#else
+            pixel_grb,
+#endif
+        .max_len = CONFIG_BLINKEN_OUTPUT2_LEDS,
+        .data_pin = CONFIG_BLINKEN_OUTPUT2_PIN,
+        .clock_pin = -1,
+        .rmt_channel = CONFIG_BLINKEN_OUTPUT2_RMT_CHANNEL,
+    };
+#endif
+    struct blinken_output *out;
+#if defined(CONFIG_WS2812_CALIBRATION)
+    unsigned int idx;
+#endif
+
+    out = &outputs[num_outputs];
+    out->ws2812 = ws2812_init(CONFIG_WS2812_MAX_LEDS, type);
+    if(out->ws2812 == NULL){
+        ESP_LOGE(TAG, "[%s] ws2812_init() failed\n", __func__);
+        return ESP_FAIL;
+    }
+    out->offset = 0;
+#if defined(CONFIG_BLINKEN_GRADE)
+    out->grade_bright = UINT_MAX;
+#endif
+    ++num_outputs;
+
+#if defined(CONFIG_BLINKEN_OUTPUT2)
+    out = &outputs[num_outputs];
+    out->ws2812 = ws2812_init_output(&output2);
+    if(out->ws2812 == NULL){
+        ESP_LOGE(TAG, "[%s] ws2812_init_output() failed\n", __func__);
+        return ESP_FAIL;
+    }
+    out->offset = CONFIG_WS2812_MAX_LEDS;
+#if defined(CONFIG_BLINKEN_GRADE)
+    out->grade_bright = UINT_MAX;
+#endif
+    ++num_outputs;
+#endif
+
+#if defined(CONFIG_WS2812_CALIBRATION)
+    for(idx = 0; idx < num_outputs; ++idx){
+        (void) ws2812_load_calibration(outputs[idx].ws2812, CALIB_PARTITION,
+                                       outputs[idx].offset);
+    }
+#endif
+
+#if defined(CONFIG_WS2812_POWER_LIMIT)
+    share_power_budget();
+#endif
+
+    return ESP_OK;
+}
+
+#if defined(CONFIG_BLINKEN_STATIC_SKIP)
+/* FNV-1a hash, good enough to tell two frames apart */
+static uint32_t hash_bytes(uint32_t hash, const void *data, size_t len)
+{
+    const uint8_t *bytes = data;
+    size_t i;
+
+    for(i = 0; i < len; ++i){
+        hash ^= bytes[i];
+        hash *= 16777619u;
+    }
+
+    return hash;
+}
+
+/*
+ * Check whether a frame would look the same as the last one encoded. Covers
+ * the pixel values, the brightness and any change to the encoder settings.
+ */
+static bool frame_is_static(hsv_value_t *hsv, rgb_value_t *rgb,
+                            unsigned int brightness, uint64_t present)
+{
+    uint32_t hash, setup;
+    unsigned int idx;
+
+    hash = 2166136261u;
+    if(rgb != NULL){
+        hash = hash_bytes(hash, rgb, handler.strip_len * sizeof(*rgb));
+    } else {
+        hash = hash_bytes(hash, hsv, handler.strip_len * sizeof(*hsv));
+    }
+
+    for(idx = 0; idx < num_outputs; ++idx){
+        setup = ws2812_get_setup_gen(outputs[idx].ws2812);
+        hash = hash_bytes(hash, &setup, sizeof(setup));
+    }
+
+    hash = hash_bytes(hash, &brightness, sizeof(brightness));
+    hash ^= (rgb != NULL);
+
+    if(hash == last_signature
+       && present - last_encoded < ms_to_us(CONFIG_BLINKEN_KEEPALIVE_MS))
+    {
+        return true;
+    }
+
+    last_signature = hash;
+    last_encoded = present;
+
+    return false;
+}
+#else
+static bool frame_is_static(hsv_value_t *hsv, rgb_value_t *rgb,
+                            unsigned int brightness, uint64_t present)
+{
+    return false;
+}
+#endif // defined(CONFIG_BLINKEN_STATIC_SKIP)
+
+/* encode the outputs' slices of the current frame, either HSV or RGB */
+static void prepare_outputs(struct blinken_frame *frame, hsv_value_t *hsv,
+                            rgb_value_t *rgb, unsigned int brightness)
+{
+    struct blinken_output *out;
+    unsigned int idx, out_bright;
+    size_t len;
+    esp_err_t result;
+
+    for(idx = 0; idx < num_outputs; ++idx){
+        out = &outputs[idx];
+        len = output_len(out, handler.strip_len);
+
+        /*
+         * Let the LEDs handle brightness if they can. Their global brightness
+         * control scales the light output, so hand it the gamma corrected
+         * value. This also keeps the full PWM resolution for the pixels.
+         */
+        out_bright = brightness;
+        result = ws2812_set_brightness(out->ws2812,
+                            SCALE_UP(gamma_tbl[SCALE_DOWN_ROUND(brightness)]));
+        if(result == ESP_OK){
+            out_bright = HSV_VAL_MAX;
+        }
+
+#if defined(CONFIG_BLINKEN_GRADE)
+        /*
+         * Graded frames get their brightness and gamma correction before
+         * the cube, so it works on the light the LEDs put out. The result
+         * goes to a buffer of its own, as filters may build on their output
+         * from the previous frame.
+         */
+        if(grade_active()){
+            if(out->grade_bright != out_bright){
+                grade_value_lut(out->grade_lut, gamma_tbl, out_bright);
+                out->grade_bright = out_bright;
+            }
+
+            grade_frame(&(handler.graded_vals[out->offset]),
+                        (rgb == NULL) ? &(hsv[out->offset]) : NULL,
+                        (rgb != NULL) ? &(rgb[out->offset]) : NULL,
+                        len, out->ws2812->type, out->grade_lut);
+
+            (void) ws2812_set_correction(out->ws2812, NULL, NULL,
+                                         HSV_VAL_MAX);
+            result = ws2812_prepare_rgb(out->ws2812,
+                                        &(handler.graded_vals[out->offset]),
+                                        len, &(frame->buffers[idx]));
+        } else
+#endif
+        {
+            /*
+             * Brightness and gamma correction are done by the driver while
+             * encoding the pixels. It only needs to rebuild its LUT when the
+             * brightness changes.
+             */
+            (void) ws2812_set_correction(out->ws2812, gamma_tbl, gamma16_tbl,
+                                         out_bright);
+
+            /* Prepare bitstream from HSV or RGB data. */
+            if(rgb != NULL){
+                result = ws2812_prepare_rgb(out->ws2812, &(rgb[out->offset]),
+                                            len, &(frame->buffers[idx]));
+            } else {
+                result = ws2812_prepare(out->ws2812, &(hsv[out->offset]),
+                                        len, &(frame->buffers[idx]));
+            }
+        }
+
+        if(result != ESP_OK){
+            ESP_LOGW(TAG, "[%s] ws2812_prepare() failed.", __func__);
+            frame->buffers[idx] = NULL;
+        }
+    }
+}
+
+/*
+ * Kick off all prepared outputs back to back. The transfers run in the
+ * background, so the strips get updated at the same time.
+ */
+static void send_outputs(struct blinken_frame *frame)
+{
+    unsigned int idx;
+    bool sent;
+
+    sent = false;
+    for(idx = 0; idx < num_outputs; ++idx){
+        if(frame->buffers[idx] != NULL){
+            (void) ws2812_send(frame->buffers[idx]);
+            frame->buffers[idx] = NULL;
+            sent = true;
+        }
+    }
+
+    if(sent){
+        ++frame_stats.transmitted;
+    }
+}
+
+/*
+ * Record the period between two refreshes as seen by the render task and its
+ * deviation from the nominal period.
+ */
+static void update_vsync_stats(uint64_t wake)
+{
+    uint32_t period, jitter, bin;
+
+    if(last_wake != 0){
+        period = (uint32_t) (wake - last_wake);
+
+        frame_stats.period_min = min(frame_stats.period_min, period);
+        frame_stats.period_max = max(frame_stats.period_max, period);
+
+        bin = period * 8 / frame_period;
+        ++frame_stats.period_hist[min(bin, FRAME_HIST_BINS - 1)];
+
+        jitter = (period > frame_period) ? period - frame_period
+                                         : frame_period - period;
+        bin = 0;
+        while(jitter > 0 && bin < FRAME_HIST_BINS - 1){
+            jitter >>= 1;
+            ++bin;
+        }
+        ++frame_stats.jitter_hist[bin];
+    }
+
+    last_wake = wake;
+}
+
+/* how late a frame went out compared to the time it was rendered for */
+static void update_frame_stats(struct blinken_frame *frame, uint64_t sent)
+{
+    int32_t late;
+
+    late = (int32_t) (sent - frame->present);
+
+    ++frame_stats.frames;
+    if(late > (int32_t) (frame_period / 2)){
+        ++frame_stats.late;
+    }
+
+    frame_stats.last_late = late;
+    frame_stats.max_late = max(frame_stats.max_late, late);
+}
+
+esp_err_t blinken_get_frame_stats(struct blinken_frame_stats *stats)
+{
+    if(stats == NULL){
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    memmove(stats, &frame_stats, sizeof(*stats));
+
+    return ESP_OK;
+}
+
+void blinken_reset_frame_stats(void)
+{
+    memset(&frame_stats, 0x0, sizeof(frame_stats));
+    frame_stats.period_min = UINT32_MAX;
+    last_wake = 0;
+}
+
+static void timer_cb(void *arg __attribute__((unused)))
+{
+    (void) xTaskNotify(render_task, (uint32_t) esp_timer_get_time(),
+                       eSetValueWithOverwrite);
+}
+
+/* wait for the next refresh, returns the time of the timer tick */
+static uint64_t wait_vsync(void)
+{
+    uint32_t tick;
     uint64_t now;
-    int evt_handled;
-    int result;
     BaseType_t status;
 
+    status = xTaskNotifyWait(0, 0, &tick, portMAX_DELAY);
+    now = esp_timer_get_time();
+    if(status != pdTRUE){
+        ESP_LOGE(TAG, "[%s] Timeout waiting for refresh.\n", __func__);
+        tick = (uint32_t) now;
+    }
+
+    update_vsync_stats(now);
+
+    /* extend the tick's timestamp to 64 bit */
+    return now - (uint32_t) ((uint32_t) now - tick);
+}
+
+/* wait for the refresh tick of the oldest pending frame and send it */
+static void send_frame(void)
+{
+    struct blinken_frame *frame;
+
+    frame_vsync = wait_vsync();
+
+    frame = &frames[frame_head];
+    send_outputs(frame);
+    update_frame_stats(frame, esp_timer_get_time());
+
+    frame_head = (frame_head + 1) % FRAMES_AHEAD;
+    --frames_pending;
+}
+
+/* send all frames still waiting in the pipeline, each on its own tick */
+static void flush_frames(void)
+{
+    while(frames_pending > 0){
+        send_frame();
+    }
+}
+
+#if defined(CONFIG_BLINKEN_EVENT_WAKEUP)
+/*
+ * Stop the refresh timer and block until the next frame is due to change,
+ * a control event comes in or blinken_set_config() posts a new config.
+ * The keep-alive bounds the time spent here.
+ * Returns the new refresh base time, or vsync if not worth sleeping.
+ */
+static uint64_t idle_sleep(QueueHandle_t evt_queue, uint64_t vsync)
+{
+    struct blinken_frame *frame;
+    struct ctrl_event evt;
+    unsigned int idx, out;
+    uint64_t deadline, now;
+    TickType_t ticks;
+
+    /* only frames with nothing to send may be dropped */
+    for(idx = 0; idx < frames_pending; ++idx){
+        frame = &frames[(frame_head + idx) % FRAMES_AHEAD];
+        for(out = 0; out < num_outputs; ++out){
+            if(frame->buffers[out] != NULL){
+                return vsync;
+            }
+        }
+    }
+
+    deadline = min(render_wake,
+                   last_encoded + ms_to_us(CONFIG_BLINKEN_KEEPALIVE_MS));
+
+    /* wake one refresh early to render the frame for the deadline */
+    now = esp_timer_get_time();
+    if(deadline < now + (FRAMES_AHEAD + 1) * frame_period){
+        return vsync;
+    }
+
+    ticks = pdMS_TO_TICKS((deadline - now - frame_period) / 1000);
+    if(ticks == 0){
+        return vsync;
+    }
+
+    /*
+     * A config posted before blinken_set_config() could see render_idle
+     * is caught by the check, any later one posts a wake-up event.
+     */
+    atomic_store(&render_idle, true);
+    if(atomic_load(&cfg_request.seq) != cfg_applied_seq){
+        atomic_store(&render_idle, false);
+        return vsync;
+    }
+
+    (void) esp_timer_stop(refresh_timer);
+    (void) xQueuePeek(evt_queue, &evt, ticks);
+    atomic_store(&render_idle, false);
+    (void) esp_timer_start_periodic(refresh_timer, frame_period);
+
+    /* drop a tick that came in before the timer was stopped */
+    (void) xTaskNotifyStateClear(NULL);
+
+    frame_head = 0;
+    frames_pending = 0;
+    last_wake = 0;
+    ++frame_stats.sleeps;
+
+    return esp_timer_get_time();
+}
+#endif // defined(CONFIG_BLINKEN_EVENT_WAKEUP)
+
+void run_strip(void)
+{
+    QueueHandle_t evt_queue;
+    struct led_filter *root;
+    struct blinken_frame *frame;
+    unsigned int brightness;
+    uint64_t now;
+    rgb_value_t *rgb;
+    bool rgb_frame, cfg_changed;
+    uint32_t prof_start;
+    int result;
+
     strip_cfg = calloc(1, sizeof(*strip_cfg));
     if(strip_cfg == NULL){
         ESP_LOGE(TAG, "[%s] Out of memory.", __func__);
@@ -419,138 +1691,155 @@ void run_strip(void)
         pixel_rgb;
 #elif defined(CONFIG_BLINKEN_TYPE_GRB)
         pixel_grb;
+#elif defined(CONFIG_BLINKEN_TYPE_APA102)
+        pixel_apa102;
 #endif
 
-    ws2812_cfg = ws2812_init(CONFIG_WS2812_MAX_LEDS, strip_cfg->type);
-    if(ws2812_cfg == NULL){
-        ESP_LOGE(TAG, "[%s] ws2812_init() failed\n", __func__);
+    result = init_outputs(strip_cfg->type);
+    if(result != ESP_OK){
         goto err_out;
     }
 
-    result = init_handler(&handler, strip_cfg, ws2812_cfg, false);
+#if defined(CONFIG_BLINKEN_GRADE)
+    /* grading is optional, carry on without a LUT */
+    (void) grade_init();
+#endif
+
+    result = init_handler(&handler, strip_cfg, false);
     if(result != 0){
         ESP_LOGE(TAG, "[%s] init_handler() failed\n", __func__);
         goto err_out;
     }
 
+    cfg_write(&cfg_active, strip_cfg, 0);
+
     result = create_filters(strip_cfg, &root, &handler.state_ptr);
     if(result != 0 || root == NULL){
         ESP_LOGE(TAG, "[%s] create_filters() failed\n", __func__);
         goto err_out;
     }
 
+#if defined(CONFIG_BLINKEN_PROFILE)
+    register_filter_profs(root);
+    prof_dirty = false;
+#endif
+
+    /* now that the root is known, give it the frame buffers it needs */
+    handler.filter_root = root;
+    result = resize_buffers(&handler, handler.strip_len);
+    if(result != ESP_OK){
+        ESP_LOGE(TAG, "[%s] Allocating frame buffers failed.", __func__);
+        goto err_out;
+    }
+
+#if defined(CONFIG_BLINKEN_PROFILE)
+    blinken_prof_start();
+#endif
+
     evt_queue = blinken_ctrl_get_queue();
     if(evt_queue == NULL){
         ESP_LOGE(TAG, "[%s] blinken_ctrl_get_queue() failed\n", __func__);
         goto err_out;
     }
 
-    handler.filter_root = root;
+    frame_vsync = esp_timer_get_time();
     while(1){
-        status = xSemaphoreTake(cfg_sema, portMAX_DELAY);
-        if(status != pdTRUE){
-            ESP_LOGE(TAG, "[%s] timeout waiting for config sema\n", __func__);
-            goto err_out;
-        }
-
-        /* handle events in event queue. */
-        while(xQueueReceive(evt_queue, &evt, 0) == pdTRUE){
-            evt_handled = 0;
+#if defined(CONFIG_BLINKEN_EVENT_WAKEUP)
+        frame_vsync = idle_sleep(evt_queue, frame_vsync);
+#endif
 
-            /* hand event to filter stack first. */
-            if(root->event != NULL){
-                evt_handled = root->event(root, handler.state_ptr, &evt);
-            }
+        /* the filters' init may rearrange the tree, so this goes first */
+        cfg_changed = apply_config();
 
-            /* if filter stack could not handle it, check if it is a
-             * light level event. If so, adjust the brightness. */
-            if(evt_handled == 0){
-                switch(evt.event){
-                case EVNT_VOLUP:
-                    strip_cfg->brightness += HSV_VAL_MAX / 20;
-                    if(strip_cfg->brightness > HSV_VAL_MAX){
-                        strip_cfg->brightness = HSV_VAL_MAX;
-                    }
-                    evt_handled = 1;
-                    break;
-                case EVNT_VOLDOWN:
-                    if(strip_cfg->brightness >= HSV_VAL_MAX / 20){
-                        strip_cfg->brightness -= HSV_VAL_MAX / 20;
-                    } else {
-                        strip_cfg->brightness = 0;
-                    }
-                    evt_handled = 1;
-                    break;
-                default:
-                    break;
-                }
-            }
-
-            /* if the event is still unhandled, hand it to the registered
-             * call-backs. */
-            if(evt_handled == 0){
-                evt_handled = run_event_cb(&evt);
-            }
+#if defined(CONFIG_BLINKEN_PROFILE)
+        if(prof_dirty){
+            register_filter_profs(root);
+            prof_dirty = false;
+        }
+#endif
 
-            if(evt_handled == 0){
-                ESP_LOGW(TAG, "[%s] Unhandled control event 0x%x.",
-                    __func__, evt.event);
-            }
+        if(update_cb_array()){
+            events_dirty = true;
         }
 
-        /* Get current timestamp. */
-        /* Fixme: Maybe use the time of the next refresh instead. */
-        now = esp_timer_get_time();
+        if(events_dirty){
+            build_event_table(root);
+        }
 
-        /* Call filter chain to generate next "frame". */
-        root->filter(root, handler.state_ptr, handler.hsv_vals,
-                        handler.strip_len, 0, now);
+        /* handle events in event queue. */
+        if(handle_events(root, evt_queue) > 0){
+#if defined(CONFIG_BLINKEN_EVENT_WAKEUP)
+            render_wake = FILTER_WAKE_NOW;
+#endif
+            cfg_changed = true;
+        }
 
         /*
-         * Copy current brightness value so we can release the config sema
-         * before doing the probably lengthy brightness correction.
+         * Render the frame for the time it will be shown: the refresh after
+         * the frames already waiting to go out.
          */
-        brightness = strip_cfg->brightness;
+        frame = &frames[(frame_head + frames_pending) % FRAMES_AHEAD];
+        frame->present = frame_vsync + (frames_pending + 1) * frame_period;
+        now = frame->present;
 
-        xSemaphoreGive(cfg_sema);
-
-        /* Adjust brightness. */
-        if(brightness != HSV_VAL_MAX){
-            for(idx = 0; idx < handler.strip_len; ++idx){
-                handler.hsv_vals[idx].value = handler.hsv_vals[idx].value * brightness / HSV_VAL_MAX;
+        /*
+         * Call filter chain to generate next "frame". Filter chains working
+         * on RGB data skip the HSV conversion altogether.
+         */
+        rgb_frame = (root->filter_rgb != NULL);
+#if defined(CONFIG_BLINKEN_EVENT_WAKEUP)
+        /* the last frame is still valid, leave the buffers as they are */
+        if(now >= render_wake)
+#endif
+        {
+            filter_reset_wake(root);
+            prof_start = PROF_BEGIN();
+            if(rgb_frame){
+                root->filter_rgb(root, handler.state_ptr, handler.rgb_vals,
+                                 handler.strip_len, 0, now);
+            } else {
+                root->filter(root, handler.state_ptr, handler.hsv_vals,
+                                handler.strip_len, 0, now);
             }
-        }
+            PROF_END(&root->prof, prof_start);
+            ++frame_stats.rendered;
 
-#if 1
-        /* Do gamma correction. */
-        for(idx = 0; idx < handler.strip_len; ++idx){
-            /*
-             * LED driver will only use the upper 8 bit, so round to nearest
-             * downscaled value and apply gamma table.
-             */
-            handler.hsv_vals[idx].value = SCALE_UP(gamma_tbl[SCALE_DOWN_ROUND(handler.hsv_vals[idx].value)]);
+#if defined(CONFIG_BLINKEN_EVENT_WAKEUP)
+            render_wake = root->wake;
 #endif
         }
 
-        /* Prepare bitstream from HSV data. */
-        result = ws2812_prepare(ws2812_cfg, handler.hsv_vals,
-                                handler.strip_len, &buffer);
-        if(result != ESP_OK){
-            ESP_LOGW(TAG, "[%s] ws2812_prepare() failed.", __func__);
-            continue;
+        /* let other tasks see the result of config changes and events */
+        if(cfg_changed){
+            cfg_write(&cfg_active, strip_cfg, now);
         }
 
+        brightness = strip_cfg->brightness;
+
+        rgb = rgb_frame ? handler.rgb_vals : NULL;
+
         /*
-         * Wait for the refresh timer to trigger before sending the data
-         * to the LED strip.
+         * Frames looking just like the last one are neither encoded nor
+         * sent. They still pass through the pipeline empty, so the timing
+         * stays the same.
          */
-        status = xSemaphoreTake(refresh_sema, portMAX_DELAY);
-        if(status != pdTRUE){
-            ESP_LOGE(TAG, "[%s] Timeout waiting for refresh sema.\n", __func__);
+        if(!frame_is_static(handler.hsv_vals, rgb, brightness,
+                            frame->present))
+        {
+            prepare_outputs(frame, handler.hsv_vals, rgb, brightness);
+            ++frame_stats.encoded;
+        }
+
+        /* fill the pipeline before waiting for the timer */
+        if(++frames_pending < FRAMES_AHEAD){
             continue;
         }
 
-        ws2812_send(buffer);
+        /*
+         * Wait for the refresh timer to trigger before sending the oldest
+         * frame to the LED strip.
+         */
+        send_frame();
     }
 
 err_out:
@@ -561,6 +1850,10 @@ err_out:
 
 void app_main(void)
 {
+    const esp_timer_create_args_t timer_args = {
+        .callback = timer_cb,
+        .name = "blinken_refresh",
+    };
     int result;
 
     ESP_LOGD(TAG, "[%s] Called\n", __func__);
@@ -578,18 +1871,11 @@ void app_main(void)
     }
     (void) xSemaphoreGive(cb_sema);
 
-    refresh_sema = xSemaphoreCreateBinary();
-    if(refresh_sema == NULL){
-        ESP_LOGE(TAG, "[%s] Mutex creation failed\n", __func__);
-        abort();
-    }
-    (void) xSemaphoreGive(refresh_sema);
-
-    refresh_timer = xTimerCreate("Blinken_Timer",
-                                 pdMS_TO_TICKS(1000) / DEF_STRIP_REFRESH,
-                                 pdTRUE, NULL, timer_cb);
+    /* run_strip() renders the frames in this task */
+    render_task = xTaskGetCurrentTaskHandle();
 
-    if(refresh_timer == NULL){
+    result = esp_timer_create(&timer_args, &refresh_timer);
+    if(result != ESP_OK){
         ESP_LOGE(TAG, "[%s] Refresh timer creation failed.", __func__);
         abort();
     }
@@ -27,6 +27,7 @@
 #include "klist.h"
 #include "ws2812.h"
 #include "control.h"
+#include "profile.h"
 
 #if !defined(min)
 #define min(a,b)            ((a) < (b) ? (a) : (b))
@@ -37,10 +38,14 @@
 #endif
 
 #define MIN_STRIP_LEN       0
+#if defined(CONFIG_BLINKEN_OUTPUT2)
+#define MAX_STRIP_LEN       (CONFIG_WS2812_MAX_LEDS + CONFIG_BLINKEN_OUTPUT2_LEDS)
+#else
 #define MAX_STRIP_LEN       CONFIG_WS2812_MAX_LEDS
+#endif
 #define DEF_STRIP_LEN       MAX_STRIP_LEN
 #define MIN_STRIP_REFRESH   1
-#define MAX_STRIP_REFRESH   100
+#define MAX_STRIP_REFRESH   400     // further limited by the strip length
 #define DEF_STRIP_REFRESH   25
 
 #define ms_to_us(ms) ((ms) * 1000)
@@ -53,14 +58,60 @@ struct blinken_cfg {
 };
 
 esp_err_t blinken_get_config(struct blinken_cfg *cfg);
+/*
+ * Checks the config and returns ESP_ERR_INVALID_SIZE or ESP_ERR_INVALID_ARG
+ * for a length, refresh rate or brightness the strip cannot take. A good
+ * one is applied by the render task at the next frame. Should that still
+ * fail, e.g. for lack of memory, the error is logged and the old config
+ * stays in place, as blinken_get_config() shows.
+ */
 esp_err_t blinken_set_config(struct blinken_cfg *cfg);
 
+/* Frame timing, see blinken_get_frame_stats(). */
+#define FRAME_HIST_BINS     16
+
+struct blinken_frame_stats {
+    uint32_t rendered;      // frames rendered by the filter tree
+    uint32_t encoded;       // frames prepared for the LEDs
+    uint32_t transmitted;   // frames sent out
+    uint32_t frames;        // refresh periods
+    uint32_t sleeps;        // times the refresh timer was stopped when idle
+    uint32_t late;          // frames sent more than half a period late
+    int32_t last_late;      // us the last frame was sent after its time
+    int32_t max_late;       // us
+    uint32_t period_min;    // us between refreshes, seen by the render task
+    uint32_t period_max;
+    /* periods in steps of 1/8 of the nominal period, last bin is overflow */
+    uint32_t period_hist[FRAME_HIST_BINS];
+    /* deviation from the nominal period, bin n counts up to 2^n - 1 us */
+    uint32_t jitter_hist[FRAME_HIST_BINS];
+    uint32_t cfg_latency_max;   // us from blinken_set_config() to applied
+    uint32_t cfg_apply_max;     // us the render loop spent applying it
+    uint32_t events;            // control events dispatched
+    uint32_t dispatch_max;      // CPU cycles of the slowest dispatch
+};
+
+esp_err_t blinken_get_frame_stats(struct blinken_frame_stats *stats);
+void blinken_reset_frame_stats(void);
+
 struct led_filter;
 
+/*
+ * Filters whose output only changes at certain times report the earliest
+ * of them with filter_set_wake(), so the strip can idle in between. Filters
+ * that do not are run for every frame.
+ */
+#define FILTER_WAKE_NOW     0
+#define FILTER_WAKE_NEVER   UINT64_MAX
+
 typedef void (*filter_fn)(struct led_filter *this, void *state,
                             hsv_value_t hsv_vals[],  unsigned int num_vals,
                             unsigned int offset, uint64_t time);
 
+typedef void (*filter_rgb_fn)(struct led_filter *this, void *state,
+                              rgb_value_t rgb_vals[], unsigned int num_vals,
+                              unsigned int offset, uint64_t time);
+
 typedef int (*event_fn)(struct led_filter *this, void *state,
                             struct ctrl_event *event);
 
@@ -69,6 +120,16 @@ typedef int (*init_fn)(struct led_filter *this, struct blinken_cfg *cfg,
 
 typedef void (*deinit_fn)(struct led_filter *this);
 
+/*
+ * Control events are dispatched from a table listing, for every event type,
+ * the filters and call-backs handling it, lowest priority value first.
+ * Filters list their event types in led_filter.events, terminated by
+ * EVNT_NONE. A filter with an event handler but no list gets all events.
+ */
+#define EVENT_PRIO_FILTER   0       // default for filters, ties in tree order
+#define EVENT_PRIO_BUILTIN  100     // brightness control in run_strip()
+#define EVENT_PRIO_CB       200     // default for register_event_cb()
+
 struct led_filter
 {
     char *name;
@@ -76,9 +137,17 @@ struct led_filter
     struct klist_head siblings;
     struct klist_head children;
     filter_fn filter;
+    filter_rgb_fn filter_rgb;   // set instead of filter to work on RGB data
     event_fn event;
+    const enum ctrl_event_type *events;
+    int event_prio;
     init_fn init;
     deinit_fn deinit;
+    uint64_t wake;              // output may change from this time on
+    uint64_t child_wake;        // earliest wake of the children run
+#if defined(CONFIG_BLINKEN_PROFILE)
+    struct blinken_prof prof;
+#endif
     void *priv;
 };
 
@@ -94,8 +163,18 @@ void run_child_filters(struct led_filter *this,
                         unsigned int offset,
                         uint64_t time);
 
+void run_child_filters_rgb(struct led_filter *this,
+                           void *state,
+                           rgb_value_t rgb_vals[],
+                           unsigned int num_vals,
+                           unsigned int offset,
+                           uint64_t time);
+
 int forward_event(struct led_filter *this, void *state, struct ctrl_event *evt);
 
+void filter_set_wake(struct led_filter *this, uint64_t wake);
+void filter_reset_wake(struct led_filter *this);
+
 esp_err_t create_filters(struct blinken_cfg *cfg,
                          struct led_filter **root,
                          void **state);
@@ -109,6 +188,9 @@ int config_override(struct blinken_cfg *cfg);
 
 typedef int (*event_cb_fn)(struct ctrl_event *event, void *priv);
 esp_err_t register_event_cb(event_cb_fn func, void *priv);
+esp_err_t register_event_cb_for(event_cb_fn func, void *priv,
+                                const enum ctrl_event_type events[],
+                                int prio);
 
 
 #endif
@@ -2,3 +2,12 @@
 # "main" pseudo-component makefile.
 #
 # (Uses default behaviour of compiling all source files in directory, adding 'include' to include path.)
+
+# High resolution gamma tables are generated at build time.
+COMPONENT_EXTRA_INCLUDES += $(COMPONENT_BUILD_DIR)
+COMPONENT_EXTRA_CLEAN := gamma16.h
+
+blinken.o: gamma16.h
+
+gamma16.h: $(COMPONENT_PATH)/gen_gamma.py
+	$(PYTHON) $< $@
@@ -49,8 +49,8 @@ static QueueSetHandle_t ctrl_queue_set;
 static SemaphoreHandle_t tx_sema;
 
 #if defined(CONFIG_BLINKEN_RMT)
-static rmt_channel_t rx_channel = RMT_CHANNEL_2;
-static rmt_channel_t tx_channel = RMT_CHANNEL_0;
+static rmt_channel_t rx_channel = CTRL_RMT_RX_CHANNEL;
+static rmt_channel_t tx_channel = CTRL_RMT_TX_CHANNEL;
 static RingbufHandle_t rxrb_handle;
 static ir_parser_t *ir_parser;
 
@@ -100,6 +100,11 @@ struct rmt_code rmt_table[] = {
     {EVNT_STOP,     RMT_ADDR, 0xe619},
 };
 
+static const enum ctrl_event_type rmt_tx_events[] = {
+    EVNT_BTN1_S,
+    EVNT_NONE
+};
+
 /* Call-back function for the TX button event. */
 static int rmt_tx_event_cb(struct ctrl_event *event, void *priv)
 {
@@ -180,7 +185,8 @@ static esp_err_t setup_rmt(void)
     }
 
     /* register the call-back function for the button event. */
-    ret = register_event_cb(rmt_tx_event_cb, NULL);
+    ret = register_event_cb_for(rmt_tx_event_cb, NULL, rmt_tx_events,
+                                EVENT_PRIO_CB);
     if(ret != ESP_OK){
         ESP_LOGE(TAG, "[%s] Registering ir_tx_event_cb failed.", __func__);
         goto err_out;
@@ -70,8 +70,17 @@ enum ctrl_event_type {
     EVNT_AIR_GOOD,
     EVNT_AIR_NORMAL,
     EVNT_AIR_BAD,
+    EVNT_MAX
 };
 
+/*
+ * RMT channels taken by the IR remote control. On the ESP32-C3 channels 0 and
+ * 1 can only transmit and 2 and 3 only receive, so an LED output on the RMT
+ * has to use channel 1 while the remote control is enabled.
+ */
+#define CTRL_RMT_TX_CHANNEL     0
+#define CTRL_RMT_RX_CHANNEL     2
+
 struct ctrl_event {
     enum ctrl_event_type event;
     bool repeat;
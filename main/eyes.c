@@ -177,12 +177,22 @@ void filter_eyes(struct led_filter *this,
         rotate_eye(&(hsv_vals[ctx->right_off - offset]), eye_gradient, shift, true, ctx->air);
     }
 
+    /* a new tick shows up in the next frame */
     if(ctx->wait <= now){
         ++ctx->ticks;
         ctx->wait = now + ms_to_us(50);
+    } else {
+        filter_set_wake(this, min(this->child_wake, ctx->wait));
     }
 }
 
+static const enum ctrl_event_type eyes_events[] = {
+    EVNT_AIR_GOOD,
+    EVNT_AIR_NORMAL,
+    EVNT_AIR_BAD,
+    EVNT_NONE
+};
+
 int event_eyes(struct led_filter *this, void *state_ptr, struct ctrl_event *evt)
 {
     unsigned int idx;
@@ -246,6 +256,7 @@ esp_err_t init_eyes(struct led_filter *this, struct blinken_cfg *cfg, bool updat
         this->init = init_eyes;
         this->deinit = filter_deinit;
         this->event = event_eyes;
+        this->events = eyes_events;
         INIT_KLIST_HEAD(&(this->children));
         INIT_KLIST_HEAD(&(this->siblings));
 
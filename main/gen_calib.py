@@ -0,0 +1,49 @@
+#!/usr/bin/env python3
+#
+# ESP32 Blinkenlights.
+#
+# Build the image for the "ledcal" partition from a list of per LED colour
+# gains. The input has one line per LED of the whole frame buffer, holding
+# the red, green, blue and optional white gain as floats from 0.0 to 1.0.
+# Empty lines and lines starting with '#' are skipped.
+#
+# The image can be flashed with
+#   esptool.py write_flash 0x110000 <output image>
+#
+# usage: gen_calib.py <gain list> <output image>
+
+import struct
+import sys
+
+CALIB_MAGIC = 0x4c41434c
+REC_SIZE = 4
+
+
+def gain(val):
+    # the driver scales by (gain + 1) / 256
+    return max(0, min(255, int(round(float(val) * 256)) - 1))
+
+
+def main():
+    recs = []
+    with open(sys.argv[1]) as f:
+        for line in f:
+            line = line.split("#")[0].strip()
+            if not line:
+                continue
+
+            vals = line.replace(",", " ").split()
+            if len(vals) == 3:
+                vals.append("1.0")
+            if len(vals) != 4:
+                sys.exit("bad line: %s" % line)
+
+            recs.append(bytes(gain(v) for v in vals))
+
+    with open(sys.argv[2], "wb") as f:
+        f.write(struct.pack("<IHH", CALIB_MAGIC, len(recs), REC_SIZE))
+        f.write(b"".join(recs))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,48 @@
+#!/usr/bin/env python3
+#
+# ESP32 Blinkenlights.
+#
+# Generate the high resolution gamma tables used for dithering. Each table
+# maps the upper 8 bit of a 16 bit HSV value to an 8.8 fixed point output
+# value. There is one extra entry at the end so the driver can interpolate
+# between neighbouring entries using the lower 8 bit of the input value.
+#
+# The 8 bit tables in gamma_*.h are the same curves rounded to integers.
+#
+# usage: gen_gamma.py <output header>
+
+import sys
+
+CURVES = (("18", 1.8), ("23", 2.3), ("28", 2.8))
+VAL_MAX = 0xff00
+
+
+def table(gamma):
+    vals = [int(round(VAL_MAX * (i / 255.0) ** gamma)) for i in range(256)]
+    vals.append(VAL_MAX)
+    return vals
+
+
+def main():
+    out = ["/* Generated by gen_gamma.py, do not edit. */", "",
+           "#ifndef __GAMMA16_H__", "#define __GAMMA16_H__", "",
+           "#include <stdint.h>", ""]
+
+    for name, gamma in CURVES:
+        vals = table(gamma)
+        out.append("/* 257-step 8.8 fixed point brightness table: "
+                   "gamma = %.1f */" % gamma)
+        out.append("const uint16_t gamma16_%s[257] = {" % name)
+        for i in range(0, len(vals), 8):
+            out.append(" " + " ".join("0x%04x," % v for v in vals[i:i + 8]))
+        out.append("};")
+        out.append("")
+
+    out.append("#endif")
+
+    with open(sys.argv[1], "w") as f:
+        f.write("\n".join(out) + "\n")
+
+
+if __name__ == "__main__":
+    main()
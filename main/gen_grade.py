@@ -0,0 +1,52 @@
+#!/usr/bin/env python3
+#
+# ESP32 Blinkenlights.
+#
+# Build the image for the "grade" partition from a 3D LUT in .cube format,
+# as exported by most colour grading tools. Only LUT_3D_SIZE and the table
+# entries are used, the input domain is assumed to be 0.0 to 1.0. The
+# entries keep the .cube order: red changes fastest, then green, then blue.
+#
+# The image can be flashed with
+#   esptool.py write_flash 0x111000 <output image>
+#
+# usage: gen_grade.py <cube file> <output image>
+
+import struct
+import sys
+
+GRADE_MAGIC = 0x44415247
+MAX_SIZE = 33
+
+
+def level(val):
+    return max(0, min(255, int(round(float(val) * 255))))
+
+
+def main():
+    size = 0
+    entries = []
+    with open(sys.argv[1]) as f:
+        for line in f:
+            line = line.split("#")[0].strip()
+            if not line:
+                continue
+
+            words = line.split()
+            if words[0] == "LUT_3D_SIZE":
+                size = int(words[1])
+            elif words[0][0].isdigit() or words[0][0] in "-.":
+                entries.append(bytes(level(v) for v in words[:3]))
+
+    if size < 2 or size > MAX_SIZE:
+        sys.exit("unsupported LUT_3D_SIZE %d" % size)
+    if len(entries) != size ** 3:
+        sys.exit("expected %d entries, got %d" % (size ** 3, len(entries)))
+
+    with open(sys.argv[2], "wb") as f:
+        f.write(struct.pack("<IHH", GRADE_MAGIC, size, 0))
+        f.write(b"".join(entries))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,297 @@
+/**
+ * ESP32 Blinkenlights.
+ * Copyright (C) 2019-2022  Tido Klaassen <tido_blinken@4gh.eu>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+/**
+ * Colour grading with a 3D look-up table.
+ *
+ * The finished frame is mapped through an RGB cube of size^3 points, with
+ * trilinear interpolation between them. Any global colour tweak (white
+ * balance, tint, desaturation) can be baked into the cube, so it costs the
+ * same per pixel no matter how many tweaks are combined.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <esp_log.h>
+#include <esp_err.h>
+#include <esp_partition.h>
+#include "kutils.h"
+#include "ws2812.h"
+#include "blinken.h"
+#include "grade.h"
+
+static const char *TAG = "GRADE";
+
+/*
+ * Layout of the grading partition: this header, followed by size^3 RGB
+ * entries with red changing fastest, then green, then blue. This is the
+ * order used by .cube files, see gen_grade.py.
+ */
+#define GRADE_PARTITION     "grade"
+#define GRADE_PART_TYPE     0x40
+#define GRADE_PART_SUBTYPE  0x02
+#define GRADE_MAGIC         0x44415247u     // "GRAD"
+#define GRADE_MIN_SIZE      2
+#define GRADE_MAX_SIZE      33
+
+struct grade_header {
+    uint32_t magic;
+    uint16_t size;          // points per axis
+    uint16_t reserved;
+};
+
+typedef uint8_t grade_entry_t[3];
+
+static grade_entry_t *grade_lut = NULL;
+static unsigned int grade_size;
+
+/*
+ * Cube cell and 8 bit position within it for every colour value, so the
+ * pixel loop needs no division whatever the cube size.
+ */
+static uint8_t axis_idx[256];
+static uint16_t axis_frac[256];     // 0 to 256
+
+static void init_axis(unsigned int size)
+{
+    unsigned int i, pos;
+
+    for(i = 0; i < ARRAY_SIZE(axis_idx); ++i){
+        pos = (i * (size - 1) * 256 + 127) / 255;
+
+        /* keep the last point in the upper corner of the last cell */
+        axis_idx[i] = min(pos >> 8, size - 2);
+        axis_frac[i] = pos - axis_idx[i] * 256;
+    }
+}
+
+/* Load the cube from flash. Without one, grading stays disabled. */
+esp_err_t grade_init(void)
+{
+    const esp_partition_t *part;
+    struct grade_header hdr;
+    grade_entry_t *lut;
+    size_t len;
+    esp_err_t result;
+
+    lut = NULL;
+
+    part = esp_partition_find_first(GRADE_PART_TYPE, GRADE_PART_SUBTYPE,
+                                    GRADE_PARTITION);
+    if(part == NULL){
+        ESP_LOGI(TAG, "[%s] No grading partition.", __func__);
+        result = ESP_ERR_NOT_FOUND;
+        goto err_out;
+    }
+
+    result = esp_partition_read(part, 0, &hdr, sizeof(hdr));
+    if(result != ESP_OK){
+        ESP_LOGE(TAG, "[%s] Reading header failed: %s.",
+                 __func__, esp_err_to_name(result));
+        goto err_out;
+    }
+
+    if(hdr.magic != GRADE_MAGIC){
+        ESP_LOGI(TAG, "[%s] No grading LUT in partition.", __func__);
+        result = ESP_ERR_NOT_FOUND;
+        goto err_out;
+    }
+
+    len = hdr.size * hdr.size * hdr.size * sizeof(*lut);
+    if(hdr.size < GRADE_MIN_SIZE || hdr.size > GRADE_MAX_SIZE
+       || sizeof(hdr) + len > part->size)
+    {
+        ESP_LOGE(TAG, "[%s] Invalid LUT size %u.", __func__, hdr.size);
+        result = ESP_ERR_INVALID_SIZE;
+        goto err_out;
+    }
+
+    lut = malloc(len);
+    if(lut == NULL){
+        ESP_LOGE(TAG, "[%s] Out of memory.", __func__);
+        result = ESP_ERR_NO_MEM;
+        goto err_out;
+    }
+
+    result = esp_partition_read(part, sizeof(hdr), lut, len);
+    if(result != ESP_OK){
+        ESP_LOGE(TAG, "[%s] Reading LUT failed: %s.",
+                 __func__, esp_err_to_name(result));
+        goto err_out;
+    }
+
+    init_axis(hdr.size);
+
+    free(grade_lut);
+    grade_lut = lut;
+    grade_size = hdr.size;
+    lut = NULL;
+
+    ESP_LOGI(TAG, "[%s] Loaded %u^3 grading LUT.", __func__, grade_size);
+
+err_out:
+    free(lut);
+
+    return result;
+}
+
+bool grade_active(void)
+{
+    return grade_lut != NULL;
+}
+
+/* interpolate between two 8.8 fixed point values, frac is 0 to 256 */
+static inline int32_t lerp(int32_t a, int32_t b, int32_t frac)
+{
+    return a + (((b - a) * frac) >> 8);
+}
+
+/* trilinear look-up of one colour in the cube */
+static inline void lookup(const uint8_t in[3], uint8_t out[3])
+{
+    const grade_entry_t *cell;
+    size_t dg, db;
+    int32_t fr, fg, fb, x00, x10, x01, x11;
+    unsigned int c;
+
+    dg = grade_size;
+    db = grade_size * grade_size;
+
+    cell = &grade_lut[axis_idx[in[2]] * db + axis_idx[in[1]] * dg
+                      + axis_idx[in[0]]];
+    fr = axis_frac[in[0]];
+    fg = axis_frac[in[1]];
+    fb = axis_frac[in[2]];
+
+    for(c = 0; c < 3; ++c){
+        x00 = lerp(cell[0][c] << 8, cell[1][c] << 8, fr);
+        x10 = lerp(cell[dg][c] << 8, cell[dg + 1][c] << 8, fr);
+        x01 = lerp(cell[db][c] << 8, cell[db + 1][c] << 8, fr);
+        x11 = lerp(cell[db + dg][c] << 8, cell[db + dg + 1][c] << 8, fr);
+
+        x00 = lerp(x00, x10, fg);
+        x01 = lerp(x01, x11, fg);
+
+        out[c] = SCALE_DOWN_ROUND(lerp(x00, x01, fb));
+    }
+}
+
+/*
+ * Map len pixels through the cube. On RGBW strips the white LED is graded
+ * as the grey it stands for: the grey part of the result stays on the white
+ * LED and any tint is added to the colour LEDs. For tweaks that scale or
+ * mix the channels, like white balance or desaturation, this is the same as
+ * grading the sum of both. dst and src may be the same buffer.
+ */
+void grade_apply(rgb_value_t dst[], const rgb_value_t src[], size_t len,
+                 enum pixel_type type)
+{
+    uint8_t in[3], out[3], tint[3], white, grey;
+    unsigned int c;
+    size_t i;
+
+    if(grade_lut == NULL){
+        if(dst != src){
+            memmove(dst, src, len * sizeof(*dst));
+        }
+        return;
+    }
+
+    for(i = 0; i < len; ++i){
+        in[0] = src[i].red;
+        in[1] = src[i].green;
+        in[2] = src[i].blue;
+        lookup(in, out);
+
+        white = src[i].white;
+        if(type == pixel_rgbw && white != 0){
+            in[0] = in[1] = in[2] = white;
+            lookup(in, tint);
+
+            grey = min(tint[0], tint[1]);
+            grey = min(grey, tint[2]);
+            for(c = 0; c < 3; ++c){
+                out[c] = min(out[c] + tint[c] - grey, 0xff);
+            }
+            white = grey;
+        }
+
+        dst[i].red = out[0];
+        dst[i].green = out[1];
+        dst[i].blue = out[2];
+        dst[i].white = white;
+    }
+}
+
+/*
+ * Fill the value table for grade_frame(): brightness scaling followed by the
+ * gamma table, the same mapping the LED driver uses while encoding.
+ */
+void grade_value_lut(uint8_t lut[256], const uint8_t gamma[256],
+                     unsigned int brightness)
+{
+    unsigned int i, idx;
+
+    brightness = min(brightness, HSV_VAL_MAX);
+
+    for(i = 0; i < 256; ++i){
+        idx = (i * brightness + HSV_VAL_MAX / 2) / HSV_VAL_MAX;
+        lut[i] = (gamma != NULL) ? gamma[idx] : idx;
+    }
+}
+
+#define GRADE_CHUNK     32
+
+/*
+ * Grade len pixels of a frame, either HSV or RGB, in output space: value_lut
+ * is applied the way the driver would, to the value of HSV pixels and to
+ * every channel of RGB ones, and the result is mapped through the cube. The
+ * graded frame must then be encoded with a linear response. This way an
+ * identity cube leaves the LEDs' output unchanged for both kinds of frames.
+ */
+void grade_frame(rgb_value_t dst[], const hsv_value_t hsv[],
+                 const rgb_value_t rgb[], size_t len, enum pixel_type type,
+                 const uint8_t value_lut[256])
+{
+    hsv_value_t tmp[GRADE_CHUNK];
+    uint32_t val;
+    size_t i, j, n;
+
+    if(hsv != NULL){
+        for(i = 0; i < len; i += n){
+            n = min(len - i, GRADE_CHUNK);
+            for(j = 0; j < n; ++j){
+                tmp[j] = hsv[i + j];
+                val = SCALE_DOWN_ROUND((uint32_t) tmp[j].value);
+                tmp[j].value = SCALE_UP(value_lut[min(val, 0xffu)]);
+            }
+            hsv2rgb_batch(tmp, &dst[i], n, type);
+        }
+    } else {
+        for(i = 0; i < len; ++i){
+            dst[i].red = value_lut[rgb[i].red];
+            dst[i].green = value_lut[rgb[i].green];
+            dst[i].blue = value_lut[rgb[i].blue];
+            dst[i].white = value_lut[rgb[i].white];
+        }
+    }
+
+    grade_apply(dst, dst, len, type);
+}
@@ -0,0 +1,36 @@
+/**
+ * ESP32 Blinkenlights.
+ * Copyright (C) 2019-2022  Tido Klaassen <tido_blinken@4gh.eu>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+#ifndef MAIN_GRADE_H_
+#define MAIN_GRADE_H_
+
+#include <stdbool.h>
+#include <esp_err.h>
+#include "ws2812.h"
+
+esp_err_t grade_init(void);
+bool grade_active(void);
+void grade_apply(rgb_value_t dst[], const rgb_value_t src[], size_t len,
+                 enum pixel_type type);
+void grade_value_lut(uint8_t lut[256], const uint8_t gamma[256],
+                     unsigned int brightness);
+void grade_frame(rgb_value_t dst[], const hsv_value_t hsv[],
+                 const rgb_value_t rgb[], size_t len, enum pixel_type type,
+                 const uint8_t value_lut[256]);
+
+#endif /* MAIN_GRADE_H_ */
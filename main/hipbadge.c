@@ -54,7 +54,10 @@ struct ctx_root {
     unsigned int brightness;
 };
 
+struct badge_layer;
+
 struct ctx_base {
+    struct badge_layer *layer;
     unsigned int fbuffer_len;
     unsigned int offset;
     unsigned int ticks;
@@ -108,6 +111,10 @@ struct ctx_badge
     unsigned int list_idx;
     unsigned int seq_idx;
     unsigned int loop_cnt;
+    struct badge_scene *scene;          // current scene, see select_scene()
+#if defined(CONFIG_BLINKEN_PROFILE)
+    struct blinken_prof *scene_prof;    // counter of the current scene
+#endif
 };
 
 typedef int (*badge_scene_fn)(struct ctx_badge *ctx, void *arg);
@@ -309,12 +316,226 @@ hsv_value_t colours[] = {
         { .value = HSV_VAL_MAX, .saturation = HSV_SAT_MAX, .hue = HSV_MAGENTA },
 };
 
+#if defined(CONFIG_BLINKEN_PROFILE)
+/* one counter per scene function, however often it shows up in the list */
+static struct scene_prof {
+    badge_scene_fn scene;
+    const char *name;
+    struct blinken_prof prof;
+} scene_profs[] = {
+    { .scene = badge_scene_fade,    .name = "scene_fade" },
+    { .scene = badge_scene_hold,    .name = "scene_hold" },
+    { .scene = badge_scene_sparkle, .name = "scene_sparkle" },
+    { .scene = badge_scene_ping,    .name = "scene_ping" },
+    { .scene = badge_scene_reflect, .name = "scene_reflect" },
+    { .scene = badge_scene_radar,   .name = "scene_radar" },
+    { .scene = badge_scene_pulse,   .name = "scene_pulse" },
+    { .scene = badge_scene_rainbow, .name = "scene_rainbow" },
+};
+
+static void register_scene_profs(void)
+{
+    unsigned int idx;
+
+    for(idx = 0; idx < ARRAY_SIZE(scene_profs); ++idx){
+        blinken_prof_register(&scene_profs[idx].prof, scene_profs[idx].name);
+    }
+}
+
+/* only looked up when a scene is selected, not each time it runs */
+static struct blinken_prof *scene_prof(badge_scene_fn scene)
+{
+    unsigned int idx;
+
+    for(idx = 0; idx < ARRAY_SIZE(scene_profs); ++idx){
+        if(scene_profs[idx].scene == scene){
+            return &scene_profs[idx].prof;
+        }
+    }
+
+    return NULL;
+}
+#endif
+
+/*
+ * Every filter that draws renders into a layer of its own, the root filter
+ * stacks them up bottom to top. The buffers come from a fixed pool with one
+ * slot per layer id, so nothing is allocated while running.
+ */
+#define LAYER_OPAQUE        256
+
+enum layer_id {
+    layer_badge = 0,
+    layer_ir,
+    layer_air,
+    NUM_LAYERS
+};
+
+enum blend_mode {
+    blend_alpha = 0,    // cover what is below
+    blend_add,          // saturating add, black is transparent
+    blend_multiply,     // darken by the layer's colour
+    blend_max,          // brightest of both per channel
+};
+
+struct badge_layer {
+    hsv_value_t *pixels;
+    enum blend_mode mode;
+    unsigned int opacity;       // 0 (invisible) to LAYER_OPAQUE
+    bool enabled;
+};
+
+static hsv_value_t layer_pool[NUM_LAYERS][FBUFFER_LEN];
+static struct badge_layer layers[NUM_LAYERS];
+static rgb_value_t base_rgb[FBUFFER_LEN];     // layer blended onto
+static rgb_value_t comp_rgb[FBUFFER_LEN];     // result of the blending
+static rgb_value_t layer_rgb[FBUFFER_LEN];    // layer being blended
+
 static struct led_filter f_root;
 static struct led_filter f_air;
 static struct led_filter f_ir;
 static struct led_filter f_nfc;
 static struct led_filter f_badge;
-static hsv_value_t fbuffer[FBUFFER_LEN];
+static hsv_value_t *fbuffer;        // pixels of the badge layer
+
+static struct badge_layer *layer_claim(enum layer_id id,
+                                       enum blend_mode mode,
+                                       unsigned int opacity)
+{
+    struct badge_layer *layer;
+
+    if(id >= NUM_LAYERS || layers[id].pixels != NULL){
+        return NULL;
+    }
+
+    layer = &layers[id];
+    layer->pixels = layer_pool[id];
+    layer->mode = mode;
+    layer->opacity = min(opacity, LAYER_OPAQUE);
+    layer->enabled = false;
+    memset(layer->pixels, 0x0, sizeof(layer_pool[id]));
+
+    return layer;
+}
+
+/* x * y / 255, rounded, for 8 bit values */
+static inline unsigned int mul8(unsigned int x, unsigned int y)
+{
+    unsigned int tmp;
+
+    tmp = x * y + 128;
+
+    return (tmp + (tmp >> 8)) >> 8;
+}
+
+/*
+ * a to b by weight w of LAYER_OPAQUE. The step is rounded to nearest on
+ * its magnitude, so fading up and fading down mirror each other.
+ */
+static inline unsigned int lerp8(unsigned int a, unsigned int b,
+                                 unsigned int w)
+{
+    if(b < a){
+        return a - (((a - b) * w + 128) >> 8);
+    }
+
+    return a + (((b - a) * w + 128) >> 8);
+}
+
+/*
+ * Fold len bytes of src into dst. The kernels work on single bytes, so they
+ * do not care about the channel order. Opacity 0 to 256 blends between dst
+ * and the mode's result in 8 bit fixed point.
+ */
+static void blend_layer(uint8_t *dst, const uint8_t *src, size_t len,
+                        enum blend_mode mode, unsigned int opacity)
+{
+    unsigned int val;
+    size_t idx;
+
+    switch(mode){
+    case blend_add:
+        for(idx = 0; idx < len; ++idx){
+            val = dst[idx] + ((src[idx] * opacity + 128) >> 8);
+            dst[idx] = min(val, 0xff);
+        }
+        break;
+    case blend_multiply:
+        for(idx = 0; idx < len; ++idx){
+            val = mul8(dst[idx], src[idx]);
+            dst[idx] = lerp8(dst[idx], val, opacity);
+        }
+        break;
+    case blend_max:
+        for(idx = 0; idx < len; ++idx){
+            val = max(dst[idx], src[idx]);
+            dst[idx] = lerp8(dst[idx], val, opacity);
+        }
+        break;
+    case blend_alpha:
+    default:
+        for(idx = 0; idx < len; ++idx){
+            dst[idx] = lerp8(dst[idx], src[idx], opacity);
+        }
+        break;
+    }
+}
+
+static inline bool layer_visible(struct badge_layer *layer)
+{
+    return layer->enabled && layer->opacity > 0;
+}
+
+static inline bool layer_covers(struct badge_layer *layer)
+{
+    return layer_visible(layer) && layer->mode == blend_alpha
+           && layer->opacity == LAYER_OPAQUE;
+}
+
+/*
+ * Blend the visible layers from first up over base in RGB and hand the
+ * result back as HSV. Pixels the layers above left alone keep the HSV of
+ * base, so they look just as they would without them.
+ */
+static void composite_layers(hsv_value_t *hsv_vals, size_t len,
+                             struct badge_layer *base, unsigned int first)
+{
+    struct badge_layer *layer;
+    unsigned int idx;
+
+    if(base != NULL){
+        hsv2rgb_batch(base->pixels, base_rgb, len, pixel_rgb);
+    } else {
+        memset(base_rgb, 0x0, len * sizeof(*base_rgb));
+    }
+    memcpy(comp_rgb, base_rgb, len * sizeof(*comp_rgb));
+
+    for(idx = first; idx < NUM_LAYERS; ++idx){
+        layer = &layers[idx];
+        if(!layer_visible(layer)){
+            continue;
+        }
+
+        hsv2rgb_batch(layer->pixels, layer_rgb, len, pixel_rgb);
+        blend_layer((uint8_t *) comp_rgb, (uint8_t *) layer_rgb,
+                    len * sizeof(*comp_rgb), layer->mode, layer->opacity);
+    }
+
+    for(idx = 0; idx < len; ++idx){
+        if(comp_rgb[idx].red == base_rgb[idx].red
+           && comp_rgb[idx].green == base_rgb[idx].green
+           && comp_rgb[idx].blue == base_rgb[idx].blue)
+        {
+            if(base != NULL){
+                hsv_vals[idx] = base->pixels[idx];
+            } else {
+                memset(&hsv_vals[idx], 0x0, sizeof(hsv_vals[idx]));
+            }
+        } else {
+            rgb2hsv(&comp_rgb[idx], &hsv_vals[idx]);
+        }
+    }
+}
 
 static void scale_fbuffer(hsv_value_t *hsv, size_t len, float factor)
 {
@@ -345,7 +566,7 @@ static void badge_init(void)
     for(g_idx = 0; g_idx < ARRAY_SIZE(badge_glyphs); ++g_idx){
         badge_glyphs[g_idx].pixels = malloc(badge_glyphs[g_idx].shape->num_pixels * sizeof(hsv_value_t *));
         configASSERT(badge_glyphs[g_idx].pixels != NULL);
-        configASSERT((cnt + badge_glyphs[g_idx].shape->num_pixels) <= ARRAY_SIZE(fbuffer));
+        configASSERT((cnt + badge_glyphs[g_idx].shape->num_pixels) <= FBUFFER_LEN);
 
         for(s_idx = 0; s_idx < badge_glyphs[g_idx].shape->num_pixels; ++s_idx){
             badge_glyphs[g_idx].pixels[s_idx] = &(fbuffer[cnt]);
@@ -443,7 +664,7 @@ static int badge_scene_sparkle(struct ctx_badge *ctx, void *arg __maybe_unused)
     } else {
         hsv.value = 0.7f * HSV_VAL_MAX;
         if(rand() % 50 == 0){
-            idx = rand() % ARRAY_SIZE(fbuffer);
+            idx = rand() % FBUFFER_LEN;
             fbuffer[idx] = hsv;
             fbuffer[idx].hue = HSV_BLUE;
             fbuffer[idx].saturation = HSV_SAT_MIN;
@@ -470,7 +691,7 @@ static int badge_scene_ping(struct ctx_badge *ctx, void *arg __maybe_unused)
     hsv.value = HSV_VAL_MAX;
     hsv.hue = HSV_BLUE;
 
-    scale_fbuffer(fbuffer, ARRAY_SIZE(fbuffer), 0.90f);
+    scale_fbuffer(fbuffer, FBUFFER_LEN, 0.90f);
     badge_circle(all_glyphs, ARRAY_SIZE(all_glyphs), origin, radius, 10.0, hsv);
 
     if(ctx->base.ticks >= 150){
@@ -555,7 +776,7 @@ static int badge_scene_pulse(struct ctx_badge *ctx, void *arg __maybe_unused)
     hsv.value = HSV_VAL_MAX;
     hsv.hue = (int)((HSV_HUE_MAX / MAX_DIST) * radius + (ctx->loop_cnt * HSV_HUE_MAX / 8)) % HSV_HUE_MAX;
 
-    scale_fbuffer(fbuffer, ARRAY_SIZE(fbuffer), 0.9925f);
+    scale_fbuffer(fbuffer, FBUFFER_LEN, 0.9925f);
     badge_circle(all_glyphs, ARRAY_SIZE(all_glyphs), origin, radius, 10.0, hsv);
 
     if(1.25 * ctx->base.ticks >= MAX_DIST){
@@ -573,7 +794,7 @@ static int badge_scene_rainbow(struct ctx_badge *ctx, void *arg __maybe_unused)
     int result;
 
     result = 0;
-    len = ARRAY_SIZE(fbuffer);
+    len = FBUFFER_LEN;
     hsv.saturation = HSV_SAT_MAX;
     hsv.value = HSV_VAL_MAX;
 
@@ -585,7 +806,7 @@ static int badge_scene_rainbow(struct ctx_badge *ctx, void *arg __maybe_unused)
     fbuffer[offset] = hsv;
 
     /* signal scene completion after three rounds. */
-    if(ctx->base.ticks >= 4 * 3 * ARRAY_SIZE(fbuffer)){
+    if(ctx->base.ticks >= 4 * 3 * FBUFFER_LEN){
         result = 1;
     }
 
@@ -596,7 +817,7 @@ static int badge_scene_fade(struct ctx_badge *ctx, void *arg __maybe_unused)
 {
     int result = 0;
 
-    scale_fbuffer(fbuffer, ARRAY_SIZE(fbuffer), 0.95f);
+    scale_fbuffer(fbuffer, FBUFFER_LEN, 0.95f);
 
     if(ctx->base.ticks >= 50){
         result = 1;
@@ -617,7 +838,7 @@ static int badge_scene_hold(struct ctx_badge *ctx, void *arg __maybe_unused)
     return result;
 }
 
-/* Root filter. Basically just copy framebuffer and adjust brightness*/
+/* Root filter. Composite the layers and adjust brightness. */
 static void filter_root(struct led_filter *this,
                         void *scene_ptr,
                         hsv_value_t hsv_vals[],
@@ -626,20 +847,55 @@ static void filter_root(struct led_filter *this,
                         uint64_t now)
 {
     struct ctx_root *ctx;
-    unsigned int idx, tmp;
+    struct badge_layer *base;
+    unsigned int idx, len, first, scale;
+    bool blended;
 
     ctx = (typeof(ctx)) this->priv;
 
     run_child_filters(this, scene_ptr, hsv_vals, strip_len, offset, now);
+    filter_set_wake(this, this->child_wake);
+
+    len = min(strip_len, FBUFFER_LEN);
+
+    /* nothing below the topmost opaque layer shows, start there */
+    base = NULL;
+    first = 0;
+    for(idx = NUM_LAYERS; idx > 0; --idx){
+        if(layer_covers(&layers[idx - 1])){
+            base = &layers[idx - 1];
+            first = idx;
+            break;
+        }
+    }
+
+    blended = false;
+    for(idx = first; idx < NUM_LAYERS; ++idx){
+        blended |= layer_visible(&layers[idx]);
+    }
 
-    memmove(&hsv_vals[0], fbuffer, sizeof(fbuffer));
+    /* a single layer is shown as it is, in HSV */
+    if(blended){
+        composite_layers(hsv_vals, len, base, first);
+    } else if(base != NULL){
+        memcpy(hsv_vals, base->pixels, len * sizeof(*hsv_vals));
+    } else {
+        memset(hsv_vals, 0x0, len * sizeof(*hsv_vals));
+    }
 
-    for(idx = 0; idx < ARRAY_SIZE(fbuffer); ++idx){
-        tmp = (hsv_vals[idx].value * (HSV_VAL_MAX / (BRIGHTNESS_STEPS - 1) * ctx->brightness)) / HSV_VAL_MAX;
-        hsv_vals[idx].value = tmp;
+    /* scale brightness */
+    scale = HSV_VAL_MAX / (BRIGHTNESS_STEPS - 1) * ctx->brightness;
+    for(idx = 0; idx < len; ++idx){
+        hsv_vals[idx].value = (hsv_vals[idx].value * scale) / HSV_VAL_MAX;
     }
 }
 
+static const enum ctrl_event_type root_events[] = {
+    EVNT_BTN0_S,
+    EVNT_VOLUP,
+    EVNT_NONE
+};
+
 static int event_root(struct led_filter *this, void *scene_ptr, struct ctrl_event *evt)
 {
     struct ctx_root *ctx;
@@ -694,6 +950,7 @@ static int init_root(struct led_filter *this, struct blinken_cfg *cfg, bool upda
         this->name = "root";
         this->filter = filter_root;
         this->event = event_root;
+        this->events = root_events;
         this->init = init_root;
         this->deinit = filter_deinit;
         INIT_KLIST_HEAD(&(this->children));
@@ -706,7 +963,7 @@ err_out:
     return result;
 }
 
-/* Air filter. React to air quality events. Top priority. */
+/* Air filter. React to air quality events. Top layer, covers the rest. */
 static void filter_air(struct led_filter *this,
                         void *scene_ptr,
                         hsv_value_t hsv_vals[],
@@ -715,12 +972,18 @@ static void filter_air(struct led_filter *this,
                         uint64_t now)
 {
     struct ctx_air *ctx;
+    hsv_value_t *pixels;
     unsigned int idx, len;
     hsv_value_t hsv;
 
     ctx = (typeof(ctx)) this->priv;
+    pixels = ctx->base.layer->pixels;
+
+    run_child_filters(this, scene_ptr, hsv_vals, strip_len, offset, now);
 
-    if(ctx->quality == air_bad || ctx->quality == air_init){
+    ctx->base.layer->enabled = (ctx->quality == air_bad
+                                || ctx->quality == air_init);
+    if(ctx->base.layer->enabled){
         hsv.saturation = HSV_SAT_MAX;
         hsv.value = HSV_VAL_MAX;
 
@@ -737,28 +1000,38 @@ static void filter_air(struct led_filter *this,
         }
 
         if(ctx->base.wait <= now){
-            len = ARRAY_SIZE(fbuffer);
+            len = FBUFFER_LEN;
 
             if(ctx->base.ticks % 100 < 10){
                 for(idx = 0; idx < FBUFFER_LEN; ++idx){
-                    fbuffer[idx] = hsv;
+                    pixels[idx] = hsv;
                 }
             } else {
-                scale_fbuffer(fbuffer, len, 0.9f);
+                scale_fbuffer(pixels, len, 0.9f);
             }
 
-            fbuffer[(0 * len / 4 + ctx->base.ticks / 5) % len] = hsv;
-            fbuffer[(1 * len / 4 + ctx->base.ticks / 5) % len] = hsv;
-            fbuffer[(2 * len / 4 + ctx->base.ticks / 5) % len] = hsv;
-            fbuffer[(3 * len / 4 + ctx->base.ticks / 5) % len] = hsv;
+            pixels[(0 * len / 4 + ctx->base.ticks / 5) % len] = hsv;
+            pixels[(1 * len / 4 + ctx->base.ticks / 5) % len] = hsv;
+            pixels[(2 * len / 4 + ctx->base.ticks / 5) % len] = hsv;
+            pixels[(3 * len / 4 + ctx->base.ticks / 5) % len] = hsv;
             ctx->base.wait += ms_to_us(10);
             ctx->base.ticks++;
         }
+
+        filter_set_wake(this, min(this->child_wake, ctx->base.wait));
     } else {
-        run_child_filters(this, scene_ptr, hsv_vals, strip_len, offset, now);
+        filter_set_wake(this, this->child_wake);
     }
 }
 
+static const enum ctrl_event_type air_events[] = {
+    EVNT_AIR_INIT,
+    EVNT_AIR_GOOD,
+    EVNT_AIR_NORMAL,
+    EVNT_AIR_BAD,
+    EVNT_NONE
+};
+
 static int event_air(struct led_filter *this, void *scene_ptr, struct ctrl_event *evt)
 {
     struct ctx_air *ctx;
@@ -829,12 +1102,22 @@ static int init_air(struct led_filter *this, struct blinken_cfg *cfg, bool updat
         }
 
         memset(ctx, 0x0, sizeof(*ctx));
+
+        ctx->base.layer = layer_claim(layer_air, blend_alpha, LAYER_OPAQUE);
+        if(ctx->base.layer == NULL){
+            ESP_LOGE(TAG, "[%s] No free layer.", __func__);
+            free(ctx);
+            result = ESP_ERR_NO_MEM;
+            goto err_out;
+        }
+
         this->priv = ctx;
 
         this->parent = NULL;
         this->name = "badge";
         this->filter = filter_air;
         this->event = event_air;
+        this->events = air_events;
         this->init = init_air;
         this->deinit = filter_deinit;
         INIT_KLIST_HEAD(&(this->children));
@@ -849,7 +1132,7 @@ err_out:
     return result;
 }
 
-/* Infrared filter. React to infrared events. */
+/* Infrared filter. React to infrared events, added over the animation. */
 static void filter_ir(struct led_filter *this,
                         void *scene_ptr,
                         hsv_value_t hsv_vals[],
@@ -858,37 +1141,49 @@ static void filter_ir(struct led_filter *this,
                         uint64_t now)
 {
     struct ctx_ir *ctx;
+    hsv_value_t *pixels;
     unsigned int idx, len;
     hsv_value_t hsv;
 
     ctx = (typeof(ctx)) this->priv;
-    len = ARRAY_SIZE(fbuffer);
+    pixels = ctx->base.layer->pixels;
+    len = FBUFFER_LEN;
+
+    run_child_filters(this, scene_ptr, hsv_vals, strip_len, offset, now);
 
-    if(ctx->base.ticks < 3 * len + 20){
+    ctx->base.layer->enabled = (ctx->base.ticks < 3 * len + 20);
+    if(ctx->base.layer->enabled){
         hsv.saturation = HSV_SAT_MAX;
         hsv.value = HSV_VAL_MAX;
         hsv.hue = HSV_YELLOW;
 
         if(ctx->base.wait <= now){
-            len = ARRAY_SIZE(fbuffer);
+            len = FBUFFER_LEN;
 
             if(ctx->base.ticks < 10 || ctx->base.ticks >= (3 * len + 10)){
                 for(idx = 0; idx < len; ++idx){
-                    fbuffer[idx] = hsv;
+                    pixels[idx] = hsv;
                 }
             } else {
-                scale_fbuffer(fbuffer, len, 0.9f);
-                fbuffer[(ctx->base.ticks - 10) % len] = hsv;
+                scale_fbuffer(pixels, len, 0.9f);
+                pixels[(ctx->base.ticks - 10) % len] = hsv;
             }
 
             ctx->base.wait += ms_to_us(10);
             ctx->base.ticks++;
         }
+
+        filter_set_wake(this, min(this->child_wake, ctx->base.wait));
     } else {
-        run_child_filters(this, scene_ptr, hsv_vals, strip_len, offset, now);
+        filter_set_wake(this, this->child_wake);
     }
 }
 
+static const enum ctrl_event_type ir_events[] = {
+    EVNT_OK,
+    EVNT_NONE
+};
+
 static int event_ir(struct led_filter *this, void *scene_ptr, struct ctrl_event *evt)
 {
     struct ctx_ir *ctx;
@@ -938,6 +1233,15 @@ static int init_ir(struct led_filter *this, struct blinken_cfg *cfg, bool update
         }
 
         memset(ctx, 0x0, sizeof(*ctx));
+
+        ctx->base.layer = layer_claim(layer_ir, blend_add, LAYER_OPAQUE);
+        if(ctx->base.layer == NULL){
+            ESP_LOGE(TAG, "[%s] No free layer.", __func__);
+            free(ctx);
+            result = ESP_ERR_NO_MEM;
+            goto err_out;
+        }
+
         ctx->base.ticks = 42000; // prevent filter from triggering
         this->priv = ctx;
 
@@ -945,6 +1249,7 @@ static int init_ir(struct led_filter *this, struct blinken_cfg *cfg, bool update
         this->name = "ir";
         this->filter = filter_ir;
         this->event = event_ir;
+        this->events = ir_events;
         this->init = init_ir;
         this->deinit = filter_deinit;
         INIT_KLIST_HEAD(&(this->children));
@@ -968,6 +1273,7 @@ static void filter_nfc(struct led_filter *this,
     ctx = (typeof(ctx)) this->priv;
 
     run_child_filters(this, scene_ptr, hsv_vals, strip_len, offset, now);
+    filter_set_wake(this, this->child_wake);
 
     if(ctx->base.wait <= now){
         ctx->base.wait += ms_to_us(10);
@@ -975,6 +1281,11 @@ static void filter_nfc(struct led_filter *this,
     }
 }
 
+/* nothing yet, only passes events on to the children */
+static const enum ctrl_event_type nfc_events[] = {
+    EVNT_NONE
+};
+
 static int event_nfc(struct led_filter *this, void *scene_ptr, struct ctrl_event *evt)
 {
     struct ctx_nfc *ctx;
@@ -1023,6 +1334,7 @@ static int init_nfc(struct led_filter *this, struct blinken_cfg *cfg, bool updat
         this->name = "nfc";
         this->filter = filter_nfc;
         this->event = event_nfc;
+        this->events = nfc_events;
         this->init = init_nfc;
         this->deinit = filter_deinit;
         INIT_KLIST_HEAD(&(this->children));
@@ -1033,6 +1345,15 @@ err_out:
     return result;
 }
 
+/* point ctx->scene at the scene list_idx and seq_idx refer to */
+static void select_scene(struct ctx_badge *ctx)
+{
+    ctx->scene = &playlist.sequences[ctx->list_idx]->scenes[ctx->seq_idx];
+#if defined(CONFIG_BLINKEN_PROFILE)
+    ctx->scene_prof = scene_prof(ctx->scene->scene);
+#endif
+}
+
 /* Base badge filter. All the standard blinky stuff. */
 static void filter_badge(struct led_filter *this,
                         void *scene_ptr,
@@ -1043,6 +1364,7 @@ static void filter_badge(struct led_filter *this,
 {
     struct ctx_badge *ctx;
     struct badge_scene *scene;
+    uint32_t start;
     int result;
 
     ctx = (typeof(ctx)) this->priv;
@@ -1052,8 +1374,10 @@ static void filter_badge(struct led_filter *this,
     if(ctx->base.wait <= now){
         ctx->base.wait += ms_to_us(10);
 
-        scene = &playlist.sequences[ctx->list_idx]->scenes[ctx->seq_idx];
+        scene = ctx->scene;
+        start = PROF_BEGIN();
         result = scene->scene(ctx, scene->arg);
+        PROF_END(ctx->scene_prof, start);
 
         ++ctx->base.ticks;
 
@@ -1065,11 +1389,21 @@ static void filter_badge(struct led_filter *this,
                 ctx->seq_idx++;
                 ctx->seq_idx %= playlist.sequences[ctx->list_idx]->seq_len;
                 ctx->loop_cnt = 0;
+                select_scene(ctx);
             }
         }
     }
+
+    /* scenes step every 10ms */
+    filter_set_wake(this, min(this->child_wake, ctx->base.wait));
 }
 
+static const enum ctrl_event_type badge_events[] = {
+    EVNT_BTN0_L,
+    EVNT_OK,
+    EVNT_NONE
+};
+
 static int event_badge(struct led_filter *this, void *scene_ptr, struct ctrl_event *evt)
 {
     struct ctx_badge *ctx;
@@ -1084,6 +1418,7 @@ static int event_badge(struct led_filter *this, void *scene_ptr, struct ctrl_eve
         ctx->list_idx++;
         ctx->list_idx %= playlist.list_len;
         ctx->seq_idx = 0;
+        select_scene(ctx);
         ctx->loop_cnt = 0;
         ctx->base.ticks = 0;
         result = 1;
@@ -1122,12 +1457,22 @@ static int init_badge(struct led_filter *this, struct blinken_cfg *cfg, bool upd
         }
 
         memset(ctx, 0x0, sizeof(*ctx));
+
+        ctx->base.layer = layer_claim(layer_badge, blend_alpha, LAYER_OPAQUE);
+        if(ctx->base.layer == NULL){
+            ESP_LOGE(TAG, "[%s] No free layer.", __func__);
+            free(ctx);
+            result = ESP_ERR_NO_MEM;
+            goto err_out;
+        }
+
         this->priv = ctx;
 
         this->parent = NULL;
         this->name = "badge";
         this->filter = filter_badge;
         this->event = event_badge;
+        this->events = badge_events;
         this->init = init_badge;
         this->deinit = filter_deinit;
         INIT_KLIST_HEAD(&(this->children));
@@ -1136,6 +1481,15 @@ static int init_badge(struct led_filter *this, struct blinken_cfg *cfg, bool upd
         ctx->base.fbuffer_len = my_arg->fbuffer_len;
         ctx->base.offset = my_arg->offset;
         ctx->base.wait = 0;
+
+#if defined(CONFIG_BLINKEN_PROFILE)
+        register_scene_profs();
+#endif
+        select_scene(ctx);
+
+        /* the scenes draw straight into the bottom layer */
+        ctx->base.layer->enabled = true;
+        fbuffer = ctx->base.layer->pixels;
     }
 
 err_out:
@@ -0,0 +1,151 @@
+/**
+ * ESP32 Blinkenlights.
+ * Copyright (C) 2019-2022  Tido Klaassen <tido_blinken@4gh.eu>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+
+/**
+ * Per filter and per scene cycle counts. All measuring, dumping and
+ * resetting happens on the render task, so no locking is needed. The dump
+ * goes to the log and is triggered by the INFO key, STOP clears the
+ * counters.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <inttypes.h>
+#include <esp_log.h>
+#include <esp_err.h>
+#include "kutils.h"
+#include "klist.h"
+#include "blinken.h"
+#include "control.h"
+#include "profile.h"
+
+static const char *TAG = "PROFILE";
+
+static KLIST_HEAD(prof_list);
+
+static void prof_clear(struct blinken_prof *prof)
+{
+    prof->calls = 0;
+    prof->min = UINT32_MAX;
+    prof->max = 0;
+    prof->total = 0;
+    memset(prof->hist, 0x0, sizeof(prof->hist));
+}
+
+/* add a counter to the dump, calling this again for it is harmless */
+void blinken_prof_register(struct blinken_prof *prof, const char *name)
+{
+    if(prof->name != NULL){
+        return;
+    }
+
+    prof->name = (name != NULL) ? name : "unknown";
+    prof_clear(prof);
+    INIT_KLIST_HEAD(&prof->list);
+    klist_add_tail(&prof->list, &prof_list);
+}
+
+void blinken_prof_add(struct blinken_prof *prof, uint32_t cycles)
+{
+    unsigned int bin;
+
+    ++prof->calls;
+    prof->total += cycles;
+    prof->min = min(prof->min, cycles);
+    prof->max = max(prof->max, cycles);
+
+    bin = (cycles != 0) ? 31 - __builtin_clz(cycles) : 0;
+    ++prof->hist[min(bin, PROF_HIST_BINS - 1)];
+}
+
+void blinken_prof_dump(void)
+{
+    struct blinken_prof *prof;
+    char line[PROF_HIST_BINS * 17];
+    unsigned int bin;
+    int len;
+
+    ESP_LOGI(TAG, "%-16s %8s %9s %9s %9s (cycles, incl. children)",
+             "name", "calls", "min", "avg", "max");
+
+    klist_for_each_entry(prof, &prof_list, list){
+        if(prof->calls == 0){
+            ESP_LOGI(TAG, "%-16s %8u", prof->name, 0);
+            continue;
+        }
+
+        ESP_LOGI(TAG, "%-16s %8" PRIu32 " %9" PRIu32 " %9" PRIu32 " %9" PRIu32,
+                 prof->name, prof->calls,
+                 prof->min, (uint32_t) (prof->total / prof->calls),
+                 prof->max);
+
+        /* only the occupied log2 bins, as 2^bin:count */
+        len = 0;
+        for(bin = 0; bin < PROF_HIST_BINS; ++bin){
+            if(prof->hist[bin] != 0){
+                len += snprintf(&line[len], sizeof(line) - len,
+                                " 2^%u:%" PRIu32, bin, prof->hist[bin]);
+            }
+        }
+        ESP_LOGI(TAG, "%-16s%s", "", line);
+    }
+}
+
+void blinken_prof_reset(void)
+{
+    struct blinken_prof *prof;
+
+    klist_for_each_entry(prof, &prof_list, list){
+        prof_clear(prof);
+    }
+}
+
+static const enum ctrl_event_type prof_events[] = {
+    EVNT_INFO,
+    EVNT_STOP,
+    EVNT_NONE
+};
+
+static int prof_event_cb(struct ctrl_event *event, void *priv __maybe_unused)
+{
+    switch(event->event){
+    case EVNT_INFO:
+        blinken_prof_dump();
+        break;
+    case EVNT_STOP:
+        blinken_prof_reset();
+        ESP_LOGI(TAG, "[%s] Counters cleared.", __func__);
+        break;
+    default:
+        return 0;
+    }
+
+    return 1;
+}
+
+void blinken_prof_start(void)
+{
+    esp_err_t result;
+
+    result = register_event_cb_for(prof_event_cb, NULL, prof_events,
+                                   EVENT_PRIO_CB);
+    if(result != ESP_OK){
+        ESP_LOGE(TAG, "[%s] Registering event call-back failed.", __func__);
+    }
+}
@@ -0,0 +1,66 @@
+/**
+ * ESP32 Blinkenlights.
+ * Copyright (C) 2019-2022  Tido Klaassen <tido_blinken@4gh.eu>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+ */
+#ifndef MAIN_PROFILE_H_
+#define MAIN_PROFILE_H_
+
+#include <stdint.h>
+#include "sdkconfig.h"
+#include "klist.h"
+
+/*
+ * Cycle count profiling of filters and badge scenes. Wrap the code to
+ * measure in
+ *
+ *     start = PROF_BEGIN();
+ *     ...
+ *     PROF_END(&prof, start);
+ *
+ * Without CONFIG_BLINKEN_PROFILE both expand to nothing and the prof
+ * argument is not evaluated, so the blinken_prof structs need not exist.
+ */
+#if defined(CONFIG_BLINKEN_PROFILE)
+#include <esp_cpu.h>
+
+#define PROF_HIST_BINS      24      // log2 of the cycle count
+
+struct blinken_prof {
+    struct klist_head list;
+    const char *name;
+    uint32_t calls;
+    uint32_t min;
+    uint32_t max;
+    uint64_t total;
+    uint32_t hist[PROF_HIST_BINS];
+};
+
+void blinken_prof_register(struct blinken_prof *prof, const char *name);
+void blinken_prof_add(struct blinken_prof *prof, uint32_t cycles);
+void blinken_prof_dump(void);
+void blinken_prof_reset(void);
+void blinken_prof_start(void);
+
+#define PROF_BEGIN()            esp_cpu_get_ccount()
+#define PROF_END(prof, start)   \
+            blinken_prof_add((prof), esp_cpu_get_ccount() - (start))
+#else
+#define PROF_BEGIN()            0
+#define PROF_END(prof, start)   do { (void) (start); } while(0)
+#endif
+
+#endif /* MAIN_PROFILE_H_ */
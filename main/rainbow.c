@@ -113,6 +113,13 @@ void filter_rainbow(struct led_filter *this,
             ctx->cycle_step = -ctx->cycle_step;
         }
     }
+
+    /* the colours move on with every frame, unless the cycle is stopped */
+    if(ctx->cycle_step != 0){
+        filter_set_wake(this, FILTER_WAKE_NOW);
+    } else {
+        filter_set_wake(this, this->child_wake);
+    }
 }
 
 esp_err_t init_rainbow(struct led_filter *this, struct blinken_cfg *cfg,
@@ -187,10 +194,15 @@ void filter_fade(struct led_filter *this,
         hsv_vals[i].value = ctx->curr_val;
     }
 
+    /* a stopped fade only changes when its children do */
     if(ctx->curr_step == 0){
+        filter_set_wake(this, this->child_wake);
         return;
     }
 
+    /* otherwise the value moves on with every frame */
+    filter_set_wake(this, FILTER_WAKE_NOW);
+
     ctx->curr_val += ctx->curr_step;
 
     if(ctx->curr_val <= ctx->min){
@@ -276,6 +288,7 @@ void filter_flicker(struct led_filter *this,
 
     if(*state != state_flicker){
         run_child_filters(this, state, hsv_vals, strip_len, offset, now);
+        filter_set_wake(this, this->child_wake);
         return;
     }
 
@@ -307,6 +320,11 @@ void filter_flicker(struct led_filter *this,
             hsv_vals[i].value = HSV_VAL_MIN;
         }
     }
+
+    /* blackouts start and end on the first frame after ctx->wait */
+    if(*state == state_flicker){
+        filter_set_wake(this, min(this->child_wake, ctx->wait + 1));
+    }
 }
 
 int init_flicker(struct led_filter *this, struct blinken_cfg *cfg,
@@ -390,10 +408,23 @@ struct ctx_lurker
     unsigned int jumps;
     uint64_t wait;
     uint64_t last_active;
+    uint64_t hit_at;            // frame of the next critical hit, 0 if unrolled
+    uint64_t frame_us;
     enum strip_state state_prev;
     enum strip_state state_next;
 };
 
+/* number of frames whose roll of the dice misses before one hits */
+static uint64_t roll_dice(struct ctx_lurker *ctx)
+{
+    uint64_t misses;
+
+    for(misses = 0; esp_random() % ctx->rate != 0; ++misses)
+        ;
+
+    return misses;
+}
+
 void filter_lurker(struct led_filter *this,
                 void *state_ptr,
                 hsv_value_t hsv_vals[],
@@ -417,12 +448,20 @@ void filter_lurker(struct led_filter *this,
     }
 
     if(*state != state_lurker){
-        /* If lurker is enabled and sleeping, roll the dice once a minute. */
+        /*
+         * If lurker is enabled and has slept for a minute, roll the dice on
+         * every frame. The rolls are made up front, so the frame of the
+         * critical hit is known and the frames before it can be skipped.
+         */
         if(*state != ctx->state_prev
             && ctx->rate > 0
             && ctx->last_active + ms_to_us(60000) < now)
         {
-            if(esp_random() % ctx->rate == 0){
+            if(ctx->hit_at == 0){
+                ctx->hit_at = now + roll_dice(ctx) * ctx->frame_us;
+            }
+
+            if(ctx->hit_at <= now){
                 /*
                  * Critical hit! Start waking lurker by moving to
                  * preparing state.
@@ -430,10 +469,23 @@ void filter_lurker(struct led_filter *this,
                 *state = ctx->state_prev;
                 ctx->state = lurker_init;
                 ctx->wait = now;
+                ctx->hit_at = 0;
             }
+        } else {
+            /* no rolls in this state, the dice have no memory anyway */
+            ctx->hit_at = 0;
         }
 
         run_child_filters(this, state, hsv_vals, strip_len, offset, now);
+
+        /* wake up in time for the first roll or the critical hit */
+        if(*state != ctx->state_prev && ctx->rate > 0){
+            filter_set_wake(this, min(this->child_wake,
+                                      (ctx->hit_at != 0) ? ctx->hit_at
+                                      : ctx->last_active + ms_to_us(60000) + 1));
+        } else {
+            filter_set_wake(this, this->child_wake);
+        }
         return;
     }
 
@@ -570,6 +622,9 @@ on_exit:
         hsv_vals[pos + 1].value = hsv_vals[pos].value / 2;
     }
 
+    if(*state == state_lurker){
+        filter_set_wake(this, ctx->wait);
+    }
 }
 
 int init_lurker(struct led_filter *this, struct blinken_cfg *cfg, bool update, void *arg)
@@ -619,6 +674,8 @@ int init_lurker(struct led_filter *this, struct blinken_cfg *cfg, bool update, v
     ctx->curr_pos = max(cfg->strip_len / 2, 2);
     ctx->curr_pos = min(ctx->curr_pos, cfg->strip_len - 2);
     ctx->rate = 10;
+    ctx->frame_us = 1000000 / cfg->refresh;
+    ctx->hit_at = 0;
 
 err_out:
     return result;
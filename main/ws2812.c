@@ -26,8 +26,12 @@
 #include <freertos/event_groups.h>
 #include <esp_log.h>
 #include <esp_system.h>
+#include <esp_heap_caps.h>
 #include <driver/spi_master.h>
 #include <driver/gpio.h>
+#if defined(CONFIG_WS2812_CALIBRATION)
+#include <esp_partition.h>
+#endif
 #include "kutils.h"
 #include "ws2812.h"
 #include "blinken.h"
@@ -42,8 +46,6 @@
 
 static const char *TAG = "WS2812";
 
-#define SCLK_FREQ       2500000 // four "bits per bit" -> 800kHz
-
 /* Events to signal completion of DMA transfer */
 #define BIT_START       (1 << 0)
 #define BIT_DONE        (1 << 1)
@@ -55,215 +57,1333 @@ static void IRAM_ATTR trans_done_cb(spi_transaction_t *trans)
 
     buffer = container_of(trans, tx_buffer_t, trans);
 
+#if defined(CONFIG_WS2812_STREAMING)
+    /*
+     * If this was the last segment in flight but not the end of the frame,
+     * the encoder did not keep up and the line went idle mid-frame.
+     */
+    if(atomic_fetch_sub(&(buffer->cfg->stream_inflight), 1) == 1
+       && !buffer->last)
+    {
+        ++buffer->cfg->underruns;
+    }
+#endif
+
     (void) xQueueSendFromISR(buffer->cfg->free_queue, &buffer, NULL);
 }
 
-/* stolen from http://www.vagrearg.org/content/hsvrgb */
-static void hsv2rgb(hsv_value_t *hsv, rgb_value_t *rgb, enum pixel_type type)
+/*
+ * Where value, slope and base level go in red, green and blue for each
+ * sextant of the hue circle.
+ */
+enum { CH_VAL, CH_SLOPE, CH_BASE };
+
+static const uint8_t sextant_perm[6][3] = {
+    { CH_VAL,   CH_SLOPE, CH_BASE  },
+    { CH_SLOPE, CH_VAL,   CH_BASE  },
+    { CH_BASE,  CH_VAL,   CH_SLOPE },
+    { CH_BASE,  CH_SLOPE, CH_VAL   },
+    { CH_SLOPE, CH_BASE,  CH_VAL   },
+    { CH_VAL,   CH_BASE,  CH_SLOPE },
+};
+
+/*
+ * stolen from http://www.vagrearg.org/content/hsvrgb
+ *
+ * Reworked to run without branches: the sextant picks the slope direction
+ * arithmetically and the channel order from sextant_perm. Pure grey needs
+ * no shortcut, the slope and base level both come out as the value then.
+ * The white channel is cleared for pixel types without one.
+ */
+static inline __attribute__((always_inline))
+void hsv2rgb(const hsv_value_t *hsv, rgb_value_t *rgb, enum pixel_type type)
 {
-    uint8_t sec, hue, sat, val, base;
-    uint32_t slope;
-    uint16_t tmp;        // Intermediate result
+    uint32_t sec, hue, sat, val, base, slope, odd, tmp;
+    uint32_t chan[3];
+    const uint8_t *perm;
 
-    sec = hsv->hue >> HSV_SEXTANT_SHIFT;
+    sec = (hsv->hue >> HSV_SEXTANT_SHIFT) % 6;
     hue = hsv->hue & 0xff;
     sat = SCALE_DOWN(hsv->saturation);
     val = SCALE_DOWN(hsv->value);
 
-    /* Take shortcut for pure grey. */
-    if(sat == 0){
+    /*
+     * base white level: value * (1.0 - saturation)
+     * --> (val * (255 - sat) + error_corr + 1) / 256
+     */
+    tmp = val * (255 - sat);
+    tmp += 1;               // Error correction
+    tmp += tmp >> 8;        // Error correction
+    base = tmp >> 8;
+
+    /* upward slope in even sextants, downward slope in odd ones */
+    odd = sec & 1;
+    tmp = (256 - hue) + odd * (2 * hue - 256);
+    slope = val * ((255 << 8) - sat * tmp);
+
+    slope += slope >> 8;    // Error correction
+    slope += val;           // Error correction
+    slope >>= 16;
+
+    chan[CH_VAL] = val;
+    chan[CH_SLOPE] = slope;
+    chan[CH_BASE] = base;
+
+    /*
+     * Move white component to separate led if pixel supports it. Pure grey
+     * goes to the white led only.
+     */
+    if(type == pixel_rgbw){
+        rgb->white = base;
+        chan[CH_VAL] -= base;
+        chan[CH_SLOPE] -= base;
+        chan[CH_BASE] &= -(uint32_t) (sat != 0);
+    } else {
+        rgb->white = 0;
+    }
+
+    perm = sextant_perm[sec];
+    rgb->red = chan[perm[0]];
+    rgb->green = chan[perm[1]];
+    rgb->blue = chan[perm[2]];
+}
+
+/* four pixels per round, so the loads of one overlap the math of another */
+static inline __attribute__((always_inline))
+void hsv2rgb_run(const hsv_value_t *in, rgb_value_t *out, size_t n,
+                 enum pixel_type type)
+{
+    size_t i;
+
+    for(i = 0; i + 4 <= n; i += 4){
+        hsv2rgb(&in[i], &out[i], type);
+        hsv2rgb(&in[i + 1], &out[i + 1], type);
+        hsv2rgb(&in[i + 2], &out[i + 2], type);
+        hsv2rgb(&in[i + 3], &out[i + 3], type);
+    }
+
+    for(; i < n; ++i){
+        hsv2rgb(&in[i], &out[i], type);
+    }
+}
+
+/* Convert n HSV values to RGB(W), for post-processing outside the driver. */
+void hsv2rgb_batch(const hsv_value_t *in, rgb_value_t *out, size_t n,
+                   enum pixel_type type)
+{
+    if(type == pixel_rgbw){
+        hsv2rgb_run(in, out, n, pixel_rgbw);
+    } else {
+        hsv2rgb_run(in, out, n, pixel_rgb);
+    }
+}
+
+/*
+ * Inverse of hsv2rgb() for 8 bit colours. The minimum channel sets the
+ * saturation and the middle one the hue, both rounded so that hsv2rgb()
+ * lands on the same channel values again, give or take one step.
+ */
+void rgb2hsv(rgb_value_t *rgb, hsv_value_t *hsv)
+{
+    unsigned int sec, hue, sat, max, min, mid, num, den;
+    bool upward;
+
+    max = max(rgb->red, max(rgb->green, rgb->blue));
+    min = min(rgb->red, min(rgb->green, rgb->blue));
+
+    hsv->value = SCALE_UP(max);
+
+    if(max == min){
+        hsv->hue = HSV_HUE_MIN;
+        hsv->saturation = HSV_SAT_MIN;
+        return;
+    }
+
+    /* hsv2rgb(): min = max * (255 - sat) / 255, rounded down */
+    sat = 255 - (min * 255 + max - 1) / max;
+
+    if(max == rgb->red && min == rgb->blue){
+        sec = 0;
+        mid = rgb->green;
+    } else if(max == rgb->green && min == rgb->blue){
+        sec = 1;
+        mid = rgb->red;
+    } else if(max == rgb->green){
+        sec = 2;
+        mid = rgb->blue;
+    } else if(max == rgb->blue && min == rgb->red){
+        sec = 3;
+        mid = rgb->green;
+    } else if(max == rgb->blue){
+        sec = 4;
+        mid = rgb->red;
+    } else {
+        sec = 5;
+        mid = rgb->blue;
+    }
+    upward = (sec % 2 == 0);
+
+    /* slope = max - max * sat * (upward ? 256 - hue : hue) / (255 << 8) */
+    num = (max - mid) * (255 << 8);
+    den = max * sat;
+    hue = min(num / den, HSV_HUE_SEXTANT);
+
+    if(upward){
+        hue = HSV_HUE_SEXTANT - hue;
+    } else {
+        hue = min(hue, HSV_HUE_SEXTANT - 1);
+    }
+
+    hsv->hue = (sec * HSV_HUE_SEXTANT + hue) % HSV_HUE_STEPS;
+    hsv->saturation = SCALE_UP(sat);
+}
+
+/*
+ * Look-up table holding the SPI data stream for every possible colour byte.
+ * Each entry contains the four (4-bit mode) or three (3-bit mode) bytes of
+ * the stream in memory order, MSB first.
+ */
+static uint32_t pwm_lut[256];
+
+#if defined(CONFIG_WS2812_ENCODING_3BIT)
+static void init_pwm_lut(void)
+{
+    unsigned int i, bit;
+    uint32_t stream;
+    uint8_t *bytes;
+
+    for(i = 0; i < ARRAY_SIZE(pwm_lut); ++i){
+        stream = 0;
+        for(bit = 0x80; bit != 0; bit >>= 1){
+            stream <<= 3;
+            stream |= (i & bit) ? WS_BIT_1 : WS_BIT_0;
+        }
+
+        pwm_lut[i] = 0;
+        bytes = (uint8_t *) &pwm_lut[i];
+        bytes[0] = (stream >> 16) ^ WS_BITS_INVERT;
+        bytes[1] = (stream >> 8) ^ WS_BITS_INVERT;
+        bytes[2] = stream ^ WS_BITS_INVERT;
+    }
+}
+
+/* colour bytes take up three bytes, so we have to copy them bytewise. */
+static inline uint8_t *put_colour(uint8_t *dst, uint8_t colour)
+{
+    const uint8_t *bytes = (const uint8_t *) &pwm_lut[colour];
+
+    dst[0] = bytes[0];
+    dst[1] = bytes[1];
+    dst[2] = bytes[2];
+
+    return dst + 3;
+}
+#else
+static void init_pwm_lut(void)
+{
+    static const uint8_t ws_bits[4] = {
+        WS_BITS_00 ^ WS_BITS_INVERT, WS_BITS_01 ^ WS_BITS_INVERT,
+        WS_BITS_10 ^ WS_BITS_INVERT, WS_BITS_11 ^ WS_BITS_INVERT
+    };
+    unsigned int i;
+    uint8_t *bytes;
+
+    for(i = 0; i < ARRAY_SIZE(pwm_lut); ++i){
+        bytes = (uint8_t *) &pwm_lut[i];
+        bytes[0] = ws_bits[(i >> 6) & 0x3];
+        bytes[1] = ws_bits[(i >> 4) & 0x3];
+        bytes[2] = ws_bits[(i >> 2) & 0x3];
+        bytes[3] = ws_bits[i & 0x3];
+    }
+}
+
+/*
+ * Every colour byte takes up a full word and the DMA buffers are word
+ * aligned, so we can write it out with a single 32 bit store.
+ */
+static inline uint8_t *put_colour(uint8_t *dst, uint8_t colour)
+{
+    *(uint32_t *) dst = pwm_lut[colour];
+
+    return dst + 4;
+}
+#endif // defined(CONFIG_WS2812_ENCODING_3BIT)
+
+/*
+ * The RMT backend expands the bits on the fly and sinks take the colours as
+ * they are, so just copy the colour.
+ */
+static inline uint8_t *put_raw(uint8_t *dst, uint8_t colour)
+{
+    *dst = colour;
+
+    return dst + 1;
+}
+
+static inline uint8_t *put_byte(uint8_t *dst, uint8_t colour,
+                                enum ws2812_backend backend)
+{
+    return backend != ws2812_spi ? put_raw(dst, colour)
+                                 : put_colour(dst, colour);
+}
+
+/*
+ * Generic pixel loop. It is always inlined into the per type/backend
+ * encoders below with constant arguments, so the colour order and the
+ * output format are resolved at compile time and the pixel loop is reduced
+ * to hsv2rgb() and three or four stores.
+ */
+#if defined(CONFIG_WS2812_DITHER)
+/*
+ * Brightness and gamma correction of a 16 bit value. The 8.8 fixed point
+ * gamma output is interpolated from the high resolution table and the
+ * fractional part left over after rounding down is carried over to the
+ * pixel's next frame, so low values average out to the right level.
+ */
+static inline __attribute__((always_inline))
+uint8_t correct_value(ws2812_t *cfg, uint32_t value, size_t pixel,
+                      unsigned int chan)
+{
+    const uint16_t *gamma = cfg->gamma16;
+    uint8_t *err = &(cfg->dither[cfg->enc_pos + pixel][chan]);
+    uint32_t idx, frac, out;
+
+    value = (value * cfg->bright_scale) >> 16;
+    idx = SCALE_DOWN(value);
+    frac = value & 0xff;
+
+    out = gamma[idx] + (((gamma[idx + 1] - gamma[idx]) * frac) >> 8);
+    out += *err;
+    *err = out & 0xff;
+
+    return min(SCALE_DOWN(out), 0xffu);
+}
+#else
+/* brightness and gamma correction of a 16 bit value via the value LUT */
+static inline __attribute__((always_inline))
+uint8_t correct_value(ws2812_t *cfg, uint32_t value, size_t pixel,
+                      unsigned int chan)
+{
+    return cfg->value_lut[min(SCALE_DOWN_ROUND(value), 0xffu)];
+}
+#endif // defined(CONFIG_WS2812_DITHER)
+
+#if defined(CONFIG_WS2812_CALIBRATION)
+/* scale a colour by its LED's calibration gain */
+static inline __attribute__((always_inline))
+uint8_t calibrate(ws2812_t *cfg, uint8_t colour, size_t pixel,
+                  unsigned int chan)
+{
+    uint32_t gain;
+
+    if(cfg->calib == NULL){
+        return colour;
+    }
+
+    gain = cfg->calib[cfg->enc_pos + pixel].gain[chan];
+
+    return (colour * (gain + 1)) >> 8;
+}
+#else
+static inline __attribute__((always_inline))
+uint8_t calibrate(ws2812_t *cfg, uint8_t colour, size_t pixel,
+                  unsigned int chan)
+{
+    return colour;
+}
+#endif // defined(CONFIG_WS2812_CALIBRATION)
+
+#if defined(CONFIG_WS2812_POWER_LIMIT)
+/*
+ * Fixed point factor applied to the corrected values to stay within the
+ * current budget. Only raise it again once there is some headroom, so the
+ * limit does not toggle between two levels on a steady scene.
+ */
+#define POWER_LIMIT_ONE     256u
+#define POWER_LIMIT_HYST    4u
+
+/*
+ * Lowest limit. It still lets a full colour through as 1, so a limited frame
+ * never reads as dark and the limit can always be worked out again.
+ */
+#define POWER_LIMIT_MIN     2u
+
+static void update_power(ws2812_t *cfg);
+
+static inline uint32_t apply_limit(ws2812_t *cfg, uint32_t value)
+{
+    return (value * cfg->power_limit) / POWER_LIMIT_ONE;
+}
+
+/*
+ * Keep a running sum of the LEDs' current, in mA * 255. Every pixel
+ * remembers its share, so updating only part of the strip still
+ * leaves the right total.
+ */
+static inline __attribute__((always_inline))
+void account_power(ws2812_t *cfg, const rgb_value_t *rgb, size_t pixel,
+                   enum pixel_type type)
+{
+    uint32_t *share = &(cfg->pix_power[cfg->enc_pos + pixel]);
+    uint32_t power;
+
+    power = rgb->red * CONFIG_WS2812_POWER_RED_MA
+            + rgb->green * CONFIG_WS2812_POWER_GREEN_MA
+            + rgb->blue * CONFIG_WS2812_POWER_BLUE_MA;
+    if(type == pixel_rgbw){
+        power += rgb->white * CONFIG_WS2812_POWER_WHITE_MA;
+    }
+
+    cfg->power_sum += power - *share;
+    *share = power;
+}
+
+/* drop the share of pixels that are turned off */
+static void clear_power(ws2812_t *cfg, size_t first, size_t len)
+{
+    size_t i;
+
+    for(i = first; i < first + len && i < cfg->max_len; ++i){
+        cfg->power_sum -= cfg->pix_power[i];
+        cfg->pix_power[i] = 0;
+    }
+}
+#else
+static inline uint32_t apply_limit(ws2812_t *cfg, uint32_t value)
+{
+    return value;
+}
+
+static inline __attribute__((always_inline))
+void account_power(ws2812_t *cfg, const rgb_value_t *rgb, size_t pixel,
+                   enum pixel_type type)
+{
+}
+
+static inline void clear_power(ws2812_t *cfg, size_t first, size_t len)
+{
+}
+
+static inline void update_power(ws2812_t *cfg)
+{
+}
+#endif // defined(CONFIG_WS2812_POWER_LIMIT)
+
+static inline __attribute__((always_inline))
+uint8_t *encode_pixels(ws2812_t *cfg, uint8_t *dst,
+                       const hsv_value_t hsv[], const rgb_value_t rgb_in[],
+                       size_t len, enum pixel_type type,
+                       enum ws2812_backend backend)
+{
+    hsv_value_t tmp;
+    rgb_value_t rgb;
+    size_t i;
+
+    for(i = 0; i < len; ++i){
+        /*
+         * One of hsv and rgb_in is NULL, inlining resolves this. Brightness
+         * and gamma correction is applied on the way.
+         */
+        if(hsv != NULL){
+            tmp = hsv[i];
+            tmp.value = SCALE_UP(correct_value(cfg, tmp.value, i, 0));
+            hsv2rgb(&tmp, &rgb, type);
+        } else {
+            rgb.red = correct_value(cfg, SCALE_UP(rgb_in[i].red), i, 0);
+            rgb.green = correct_value(cfg, SCALE_UP(rgb_in[i].green), i, 1);
+            rgb.blue = correct_value(cfg, SCALE_UP(rgb_in[i].blue), i, 2);
+            rgb.white = correct_value(cfg, SCALE_UP(rgb_in[i].white), i, 3);
+        }
+
+        /* even out differences between the LEDs in linear light */
+        rgb.red = calibrate(cfg, rgb.red, i, 0);
+        rgb.green = calibrate(cfg, rgb.green, i, 1);
+        rgb.blue = calibrate(cfg, rgb.blue, i, 2);
         if(type == pixel_rgbw){
-            rgb->white = val;
-            val = 0;
+            rgb.white = calibrate(cfg, rgb.white, i, 3);
         }
 
-        rgb->red = rgb->green = rgb->blue = val;
-        return;
+        account_power(cfg, &rgb, i, type);
+
+        switch(type){
+        case pixel_grb:
+            dst = put_byte(dst, rgb.green, backend);
+            dst = put_byte(dst, rgb.red, backend);
+            dst = put_byte(dst, rgb.blue, backend);
+            break;
+        case pixel_rgb:
+            dst = put_byte(dst, rgb.red, backend);
+            dst = put_byte(dst, rgb.green, backend);
+            dst = put_byte(dst, rgb.blue, backend);
+            break;
+        case pixel_rgbw:
+            dst = put_byte(dst, rgb.red, backend);
+            dst = put_byte(dst, rgb.green, backend);
+            dst = put_byte(dst, rgb.blue, backend);
+            dst = put_byte(dst, rgb.white, backend);
+            break;
+        case pixel_apa102:
+            /* no bit expansion, just header and BGR in one word */
+            *(uint32_t *) dst = cfg->apa102_hdr
+                                | (uint32_t) rgb.blue << 8
+                                | (uint32_t) rgb.green << 16
+                                | (uint32_t) rgb.red << 24;
+            dst += 4;
+            break;
+        }
+    }
+
+    return dst;
+}
+
+/*
+ * Create HSV and RGB encoders for a pixel type and backend, so each of them
+ * gets its own specialised copy of encode_pixels().
+ */
+#define DEFINE_ENCODERS(name, type, backend)                                \
+static uint8_t *hsv_##name(ws2812_t *cfg, uint8_t *dst,                     \
+                           const hsv_value_t hsv[], size_t len)             \
+{                                                                           \
+    return encode_pixels(cfg, dst, hsv, NULL, len, type, backend);          \
+}                                                                           \
+                                                                            \
+static uint8_t *rgb_##name(ws2812_t *cfg, uint8_t *dst,                     \
+                           const rgb_value_t rgb[], size_t len)             \
+{                                                                           \
+    return encode_pixels(cfg, dst, NULL, rgb, len, type, backend);          \
+}
+
+DEFINE_ENCODERS(spi_grb, pixel_grb, ws2812_spi)
+DEFINE_ENCODERS(spi_rgb, pixel_rgb, ws2812_spi)
+DEFINE_ENCODERS(spi_rgbw, pixel_rgbw, ws2812_spi)
+DEFINE_ENCODERS(spi_apa102, pixel_apa102, ws2812_spi)
+DEFINE_ENCODERS(rmt_grb, pixel_grb, ws2812_rmt)
+DEFINE_ENCODERS(rmt_rgb, pixel_rgb, ws2812_rmt)
+DEFINE_ENCODERS(rmt_rgbw, pixel_rgbw, ws2812_rmt)
+
+#define ENCODERS(name)      { .hsv = hsv_##name, .rgb = rgb_##name }
+
+/* pick the encoders for the configured pixel type and backend */
+static esp_err_t set_encoders(ws2812_t *cfg)
+{
+    static const struct {
+        encode_fn hsv;
+        encode_rgb_fn rgb;
+    } encoders[][4] = {
+        [ws2812_spi] = {
+            [pixel_rgb] = ENCODERS(spi_rgb),
+            [pixel_grb] = ENCODERS(spi_grb),
+            [pixel_rgbw] = ENCODERS(spi_rgbw),
+            [pixel_apa102] = ENCODERS(spi_apa102),
+        },
+        [ws2812_rmt] = {
+            [pixel_rgb] = ENCODERS(rmt_rgb),
+            [pixel_grb] = ENCODERS(rmt_grb),
+            [pixel_rgbw] = ENCODERS(rmt_rgbw),
+        },
+        [ws2812_sink] = {
+            [pixel_rgb] = ENCODERS(rmt_rgb),
+            [pixel_grb] = ENCODERS(rmt_grb),
+            [pixel_rgbw] = ENCODERS(rmt_rgbw),
+        },
+    };
+
+    if(cfg->backend >= ARRAY_SIZE(encoders)
+       || cfg->type >= ARRAY_SIZE(encoders[0])
+       || encoders[cfg->backend][cfg->type].hsv == NULL)
+    {
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    cfg->encode = encoders[cfg->backend][cfg->type].hsv;
+    cfg->encode_rgb = encoders[cfg->backend][cfg->type].rgb;
+
+    return ESP_OK;
+}
+
+/* RMT and sink outputs take plain colour bytes instead of an SPI bit stream */
+static bool raw_output(ws2812_t *cfg)
+{
+    return cfg->backend != ws2812_spi;
+}
+
+/* bytes per pixel before bit expansion */
+static unsigned int pixel_colours(enum pixel_type type)
+{
+    return (type == pixel_rgbw || type == pixel_apa102) ? 4 : 3;
+}
+
+/*
+ * APA102 end frame: the data is delayed by half a clock at each LED, so we
+ * need to send len / 2 extra clocks to push it to the end of the strip. SK9822
+ * additionally wants a 32 bit reset frame before that.
+ */
+static size_t apa102_end_len(uint16_t len)
+{
+    return APA102_FRAME_LEN + (len + 15) / 16;
+}
+
+/* length of start frame and end frame/reset pulse */
+static size_t frame_overhead(enum pixel_type type, uint16_t len)
+{
+    if(type == pixel_apa102){
+        return APA102_FRAME_LEN + apa102_end_len(len);
+    }
+
+    return WS2812_RESET_LEN;
+}
+
+/* size of the output buffer needed for a strip of len pixels */
+static size_t buffer_len(ws2812_t *cfg, uint16_t len)
+{
+    if(raw_output(cfg)){
+        return len * pixel_colours(cfg->type);
+    }
+
+#if defined(CONFIG_WS2812_STREAMING)
+    /* buffers only hold one segment of the strip */
+    return ws2812_data_len(cfg->type, CONFIG_WS2812_STREAM_CHUNK)
+           + frame_overhead(cfg->type, cfg->max_len);
+#else
+    return ws2812_dmabuf_len(cfg->type, len);
+#endif
+}
+
+/* fill data stream for len pixels with "off" values */
+static uint8_t *encode_off(ws2812_t *cfg, uint8_t *dst, size_t len)
+{
+    size_t i;
+
+    if(cfg->type == pixel_apa102){
+        for(i = 0; i < len; ++i){
+            *(uint32_t *) dst = APA102_HEADER;
+            dst += 4;
+        }
+
+        return dst;
+    }
+
+    len *= pixel_colours(cfg->type);
+    for(i = 0; i < len; ++i){
+        dst = put_byte(dst, 0, cfg->backend);
+    }
+
+    return dst;
+}
+
+/* add start frame to beginning of data stream */
+static uint8_t *encode_start(ws2812_t *cfg, uint8_t *dst)
+{
+    if(cfg->type != pixel_apa102){
+        return dst;
+    }
+
+    memset(dst, 0x0, APA102_FRAME_LEN);
+
+    return dst + APA102_FRAME_LEN;
+}
+
+/* add reset pulse or end frame to end of data stream */
+static uint8_t *encode_reset(ws2812_t *cfg, uint8_t *dst)
+{
+    size_t len;
+
+    /* RMT line idles low between frames, nothing to add. */
+    if(raw_output(cfg)){
+        return dst;
+    }
+
+    if(cfg->type == pixel_apa102){
+        len = apa102_end_len(cfg->strip_len);
+        memset(dst, 0x0, len);
+
+        return dst + len;
+    }
+
+    memset(dst, WS_BITS_RESET ^ WS_BITS_INVERT, WS2812_RESET_LEN);
+
+    return dst + WS2812_RESET_LEN;
+}
+
+#if defined(CONFIG_WS2812_STREAMING)
+/*
+ * Streaming mode: the DMA buffers only hold CONFIG_WS2812_STREAM_CHUNK
+ * pixels each. ws2812_prepare() encodes as many segments as there are free
+ * buffers, ws2812_send() queues them and keeps encoding the rest of the strip
+ * into the buffers handed back by trans_done_cb() as the transfer proceeds.
+ */
+
+/* encode next segment of the strip into buffer */
+static void stream_encode(ws2812_t *cfg, tx_buffer_t *buffer)
+{
+    uint8_t *bufp;
+    size_t len, data;
+
+    len = min(cfg->strip_len - cfg->stream_pos, CONFIG_WS2812_STREAM_CHUNK);
+    data = 0;
+    if(cfg->stream_pos < cfg->stream_len){
+        data = min(len, cfg->stream_len - cfg->stream_pos);
+    }
+
+    bufp = buffer->buff;
+    if(cfg->stream_pos == 0){
+        bufp = encode_start(cfg, bufp);
+    }
+
+    cfg->enc_pos = cfg->stream_pos;
+    if(cfg->stream_rgb != NULL){
+        bufp = cfg->encode_rgb(cfg, bufp, &(cfg->stream_rgb[cfg->stream_pos]),
+                               data);
+    } else {
+        bufp = cfg->encode(cfg, bufp, &(cfg->stream_src[cfg->stream_pos]),
+                           data);
+    }
+    bufp = encode_off(cfg, bufp, len - data);
+    clear_power(cfg, cfg->stream_pos + data, len - data);
+    cfg->pix_encoded += data;
+    cfg->stream_pos += len;
+
+    buffer->last = cfg->stream_pos >= cfg->strip_len;
+    if(buffer->last){
+        bufp = encode_reset(cfg, bufp);
+        update_power(cfg);
+    }
+
+    buffer->trans.length = (bufp - buffer->buff) * 8;
+}
+
+static esp_err_t stream_queue(ws2812_t *cfg, tx_buffer_t *buffer)
+{
+    esp_err_t result;
+
+    (void) atomic_fetch_add(&(cfg->stream_inflight), 1);
+    result = spi_device_queue_trans(cfg->spi_master, &(buffer->trans),
+                                    portMAX_DELAY);
+    if(result != ESP_OK){
+        ESP_LOGE(TAG, "[%s] spi_device_queue_trans() failed: %s.",
+                __func__, esp_err_to_name(result));
+        (void) atomic_fetch_sub(&(cfg->stream_inflight), 1);
+        (void) xQueueSend(cfg->free_queue, &buffer, portMAX_DELAY);
+    }
+
+    return result;
+}
+
+static esp_err_t stream_prepare(ws2812_t *cfg, const hsv_value_t hsv_values[],
+                                const rgb_value_t rgb_values[],
+                                size_t strip_len, tx_buffer_t **buffer)
+{
+    tx_buffer_t *tx_buff;
+    BaseType_t status;
+    esp_err_t result;
+
+    result = ESP_OK;
+
+    cfg->stream_src = hsv_values;
+    cfg->stream_rgb = rgb_values;
+    cfg->stream_len = min(strip_len, cfg->strip_len);
+    cfg->stream_pos = 0;
+    cfg->stream_ready = 0;
+
+    /* pre-fill all free buffers so the transfer starts with a full ring */
+    do {
+        status = xQueueReceive(cfg->free_queue, &tx_buff, portMAX_DELAY);
+        if(status != pdTRUE){
+            ESP_LOGE(TAG, "[%s] Error fetching buffer.", __func__);
+            result = ESP_ERR_NO_MEM;
+            goto err_out;
+        }
+
+        stream_encode(cfg, tx_buff);
+        cfg->stream_buffs[cfg->stream_ready++] = tx_buff;
+    } while(cfg->stream_pos < cfg->strip_len
+            && cfg->stream_ready < NUM_DMA_BUFFS);
+
+    *buffer = cfg->stream_buffs[0];
+
+err_out:
+    if(result != ESP_OK){
+        while(cfg->stream_ready > 0){
+            --cfg->stream_ready;
+            (void) xQueueSend(cfg->free_queue,
+                              &(cfg->stream_buffs[cfg->stream_ready]),
+                              portMAX_DELAY);
+        }
+    }
+
+    return result;
+}
+
+static esp_err_t stream_send(ws2812_t *cfg)
+{
+    tx_buffer_t *tx_buff;
+    unsigned int i;
+    BaseType_t status;
+    esp_err_t result;
+
+    result = ESP_OK;
+
+    for(i = 0; i < cfg->stream_ready; ++i){
+        result = stream_queue(cfg, cfg->stream_buffs[i]);
+        if(result != ESP_OK){
+            /* hand back the segments we did not get to queue */
+            for(++i; i < cfg->stream_ready; ++i){
+                (void) xQueueSend(cfg->free_queue, &(cfg->stream_buffs[i]),
+                                  portMAX_DELAY);
+            }
+            goto err_out;
+        }
+    }
+
+    /* refill buffers as they come back from the DMA */
+    while(cfg->stream_pos < cfg->strip_len){
+        status = xQueueReceive(cfg->free_queue, &tx_buff, portMAX_DELAY);
+        if(status != pdTRUE){
+            ESP_LOGE(TAG, "[%s] Error fetching buffer.", __func__);
+            result = ESP_ERR_NO_MEM;
+            goto err_out;
+        }
+
+        stream_encode(cfg, tx_buff);
+
+        result = stream_queue(cfg, tx_buff);
+        if(result != ESP_OK){
+            goto err_out;
+        }
+    }
+
+err_out:
+    cfg->stream_ready = 0;
+    cfg->stream_src = NULL;
+    cfg->stream_rgb = NULL;
+
+    return result;
+}
+
+uint32_t ws2812_get_underruns(ws2812_t *cfg)
+{
+    return cfg->underruns;
+}
+#endif // defined(CONFIG_WS2812_STREAMING)
+
+esp_err_t ws2812_send(tx_buffer_t *buffer)
+{
+    ws2812_t *cfg;
+    esp_err_t result;
+
+    result = 0;
+    if(buffer == NULL){
+        ESP_LOGE(TAG, "[%s] DMA buffer invalid\n", __func__);
+        result = ESP_FAIL;
+        goto err_out;
+    }
+
+    cfg = buffer->cfg;
+    if(cfg->backend == ws2812_rmt){
+        result = ws2812_rmt_send(buffer);
+        goto err_out;
+    }
+
+    if(cfg->backend == ws2812_sink){
+        cfg->sink(cfg, buffer->buff, buffer->trans.length / 8, cfg->sink_priv);
+        (void) xQueueSend(cfg->free_queue, &buffer, 0);
+        goto err_out;
+    }
+
+#if defined(CONFIG_WS2812_STREAMING)
+    result = stream_send(cfg);
+    goto err_out;
+#endif
+
+    /* transaction was set up by ws2812_prepare(), just queue it */
+    result = spi_device_queue_trans(cfg->spi_master, &(buffer->trans),
+                                    portMAX_DELAY);
+    if(result != ESP_OK){
+        ESP_LOGE(TAG, "[%s] spi_device_queue_trans() failed: %s.",
+                __func__, esp_err_to_name(result));
+        goto err_out;
+    }
+
+err_out:
+    return result;
+}
+
+/* Force a full encode for every buffer, e.g. when encoder settings change. */
+static void invalidate_buffers(ws2812_t *cfg)
+{
+    cfg->min_gen = cfg->generation + 1;
+    ++cfg->setup_gen;
+}
+
+/*
+ * Set the LEDs' global brightness, 0 to HSV_VAL_MAX. This is only supported
+ * by LEDs with a brightness control of their own (APA102/SK9822). The value
+ * is applied to the light output, so it should already be gamma corrected.
+ */
+esp_err_t ws2812_set_brightness(ws2812_t *cfg, uint16_t brightness)
+{
+    uint32_t level;
+
+    if(cfg == NULL){
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    if(cfg->type != pixel_apa102){
+        return ESP_ERR_NOT_SUPPORTED;
+    }
+
+    brightness = min(brightness, HSV_VAL_MAX);
+
+    /* round up so that low brightness does not turn the LEDs off */
+    level = (brightness * APA102_BRIGHT_MAX + HSV_VAL_MAX - 1) / HSV_VAL_MAX;
+    if(cfg->apa102_hdr != (APA102_HEADER | level)){
+        cfg->apa102_hdr = APA102_HEADER | level;
+        invalidate_buffers(cfg);
     }
 
-    if(sec > 5){
-        sec %= 6;
+    return ESP_OK;
+}
+
+#if defined(CONFIG_WS2812_DITHER)
+static void build_lut(ws2812_t *cfg, const uint8_t gamma[256],
+                      const uint16_t gamma16[257], uint16_t brightness)
+{
+    unsigned int i;
+
+    for(i = 0; i < ARRAY_SIZE(cfg->gamma16); ++i){
+        cfg->gamma16[i] = apply_limit(cfg, (gamma16 != NULL)
+                                              ? gamma16[i]
+                                              : min(SCALE_UP(i), HSV_VAL_MAX));
+    }
+
+    /* 16.16 fixed point factor, saves a division per pixel */
+    cfg->bright_scale = ((uint32_t) brightness << 16) / HSV_VAL_MAX;
+}
+#else
+static void build_lut(ws2812_t *cfg, const uint8_t gamma[256],
+                      const uint16_t gamma16[257], uint16_t brightness)
+{
+    unsigned int i, idx;
+
+    for(i = 0; i < ARRAY_SIZE(cfg->value_lut); ++i){
+        idx = (i * brightness + HSV_VAL_MAX / 2) / HSV_VAL_MAX;
+        cfg->value_lut[i] = apply_limit(cfg, (gamma != NULL) ? gamma[idx]
+                                                             : idx);
+    }
+}
+#endif // defined(CONFIG_WS2812_DITHER)
+
+/*
+ * Set the correction applied to pixel values while encoding: brightness
+ * scaling (0 to HSV_VAL_MAX) followed by a gamma table. Without dithering,
+ * both are folded into a single look-up table, which is only rebuilt when
+ * either of them changes. With dithering, the high resolution table gamma16
+ * is used instead of gamma. Pass NULL as tables for a linear response.
+ */
+esp_err_t ws2812_set_correction(ws2812_t *cfg, const uint8_t gamma[256],
+                                const uint16_t gamma16[257],
+                                uint16_t brightness)
+{
+    if(cfg == NULL){
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    brightness = min(brightness, HSV_VAL_MAX);
+
+    if(gamma == cfg->lut_gamma && gamma16 == cfg->lut_gamma16
+       && brightness == cfg->lut_brightness)
+    {
+        return ESP_OK;
+    }
+
+    build_lut(cfg, gamma, gamma16, brightness);
+
+    cfg->lut_gamma = gamma;
+    cfg->lut_gamma16 = gamma16;
+    cfg->lut_brightness = brightness;
+    invalidate_buffers(cfg);
+
+    return ESP_OK;
+}
+
+#if defined(CONFIG_WS2812_POWER_LIMIT)
+/*
+ * Called once a frame is completely encoded. Estimate its current and set
+ * the limit for the following frames. The draw scales linearly with the
+ * limit, so aim straight for the budget.
+ */
+static void update_power(ws2812_t *cfg)
+{
+    uint32_t sum, idle, avail, limit;
+
+    /* mA * 255, as drawn with the current limit applied */
+    sum = cfg->power_sum;
+    if(cfg->type == pixel_apa102){
+        sum = sum * (cfg->apa102_hdr & APA102_BRIGHT_MAX) / APA102_BRIGHT_MAX;
     }
 
+    idle = cfg->strip_len * CONFIG_WS2812_POWER_IDLE_UA / 1000;
+    cfg->power_draw = sum / 255 + idle;
+
     /*
-     * base white level: value * (1.0 - saturation)
-     * --> (val * (255 - sat) + error_corr + 1) / 256
+     * A dark frame says nothing about how bright the next one will be, so
+     * keep the limit. Dropping it would let the next bright frame through
+     * at full level for one frame.
      */
-    tmp = val * (255 - sat);
-    tmp += 1;               // Error correction
-    tmp += tmp >> 8;        // Error correction
-    base = tmp >> 8;
+    if(sum == 0){
+        return;
+    }
+
+    /* scale the limit this frame was encoded with by how far off it was */
+    avail = (cfg->power_budget > idle) ? cfg->power_budget - idle : 0;
+    limit = (uint64_t) cfg->power_limit * avail * 255 / sum;
+    limit = max(min(limit, POWER_LIMIT_ONE), POWER_LIMIT_MIN);
+
+    /* lower it right away, but only raise it again with some headroom */
+    if(limit > cfg->power_limit && limit != POWER_LIMIT_ONE
+       && limit < cfg->power_limit + POWER_LIMIT_HYST)
+    {
+        limit = cfg->power_limit;
+    }
+
+    if(limit != cfg->power_limit){
+        cfg->power_limit = limit;
+        build_lut(cfg, cfg->lut_gamma, cfg->lut_gamma16, cfg->lut_brightness);
+        invalidate_buffers(cfg);
+    }
+}
+
+/* Set the current budget in mA for this output's LEDs. */
+esp_err_t ws2812_set_power_budget(ws2812_t *cfg, uint32_t budget)
+{
+    if(cfg == NULL){
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    cfg->power_budget = budget;
+
+    return ESP_OK;
+}
+
+/* Estimated current in mA drawn by the last completely encoded frame. */
+uint32_t ws2812_get_current(ws2812_t *cfg)
+{
+    return cfg->power_draw;
+}
+#endif // defined(CONFIG_WS2812_POWER_LIMIT)
+
+#if defined(CONFIG_WS2812_CALIBRATION)
+/*
+ * Layout of the calibration partition: this header, followed by one
+ * ws2812_calib_t per LED of the whole frame buffer.
+ */
+#define CALIB_PART_TYPE     0x40
+#define CALIB_PART_SUBTYPE  0x01
+#define CALIB_MAGIC         0x4c41434cu     // "LCAL"
+
+struct calib_header {
+    uint32_t magic;
+    uint16_t count;         // number of records
+    uint16_t rec_size;      // sizeof(ws2812_calib_t)
+};
+
+/* the gain table is only allocated once calibration is set or loaded */
+static esp_err_t alloc_calibration(ws2812_t *cfg)
+{
+    if(cfg->calib == NULL){
+        cfg->calib = malloc(cfg->max_len * sizeof(*cfg->calib));
+        if(cfg->calib == NULL){
+            ESP_LOGE(TAG, "[%s] Allocating calibration table failed.",
+                     __func__);
+            return ESP_ERR_NO_MEM;
+        }
+    }
+
+    return ESP_OK;
+}
+
+/*
+ * Set the colour gains for the first len LEDs, the rest are set to unity.
+ * Pass NULL to turn calibration off and release the table.
+ */
+esp_err_t ws2812_set_calibration(ws2812_t *cfg, const ws2812_calib_t calib[],
+                                 size_t len)
+{
+    esp_err_t result;
+
+    if(cfg == NULL || (calib == NULL && len > 0)){
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    if(calib == NULL){
+        free(cfg->calib);
+        cfg->calib = NULL;
+        invalidate_buffers(cfg);
+        return ESP_OK;
+    }
+
+    result = alloc_calibration(cfg);
+    if(result != ESP_OK){
+        return result;
+    }
+
+    len = min(len, (size_t) cfg->max_len);
+    if(len > 0 && calib != cfg->calib){
+        memcpy(cfg->calib, calib, len * sizeof(*calib));
+    }
+
+    memset(&(cfg->calib[len]), 0xff, (cfg->max_len - len) * sizeof(*calib));
+
+    invalidate_buffers(cfg);
+
+    return ESP_OK;
+}
+
+/*
+ * Load the colour gains from the calibration partition. The records are
+ * numbered across all outputs, first is the index of this output's first
+ * LED. A missing or blank partition leaves the LEDs uncalibrated.
+ */
+esp_err_t ws2812_load_calibration(ws2812_t *cfg, const char *label,
+                                  size_t first)
+{
+    const esp_partition_t *part;
+    struct calib_header hdr;
+    size_t len;
+    esp_err_t result;
+
+    if(cfg == NULL || label == NULL){
+        return ESP_ERR_INVALID_ARG;
+    }
+
+    part = esp_partition_find_first(CALIB_PART_TYPE, CALIB_PART_SUBTYPE,
+                                    label);
+    if(part == NULL){
+        ESP_LOGI(TAG, "[%s] No calibration partition \"%s\".",
+                 __func__, label);
+        result = ESP_ERR_NOT_FOUND;
+        goto err_out;
+    }
+
+    result = esp_partition_read(part, 0, &hdr, sizeof(hdr));
+    if(result != ESP_OK){
+        ESP_LOGE(TAG, "[%s] Reading calibration header failed: %s.",
+                 __func__, esp_err_to_name(result));
+        goto err_out;
+    }
+
+    if(hdr.magic != CALIB_MAGIC || hdr.rec_size != sizeof(ws2812_calib_t)){
+        ESP_LOGI(TAG, "[%s] No calibration data in \"%s\".",
+                 __func__, label);
+        result = ESP_ERR_NOT_FOUND;
+        goto err_out;
+    }
+
+    if(sizeof(hdr) + hdr.count * sizeof(ws2812_calib_t) > part->size){
+        ESP_LOGE(TAG, "[%s] Calibration data exceeds partition.", __func__);
+        result = ESP_ERR_INVALID_SIZE;
+        goto err_out;
+    }
+
+    len = (hdr.count > first) ? hdr.count - first : 0;
+    len = min(len, (size_t) cfg->max_len);
+
+    result = alloc_calibration(cfg);
+    if(result != ESP_OK){
+        goto err_out;
+    }
+
+    /* read straight into the table, pad the rest with unity gains */
+    result = esp_partition_read(part,
+                                sizeof(hdr) + first * sizeof(ws2812_calib_t),
+                                cfg->calib, len * sizeof(ws2812_calib_t));
+    if(result != ESP_OK){
+        ESP_LOGE(TAG, "[%s] Reading calibration data failed: %s.",
+                 __func__, esp_err_to_name(result));
+        len = 0;
+    }
+
+    (void) ws2812_set_calibration(cfg, cfg->calib, len);
+
+err_out:
+    return result;
+}
+#endif // defined(CONFIG_WS2812_CALIBRATION)
+
+/*
+ * Counter that changes whenever the same pixel values would be encoded
+ * differently, e.g. after a brightness or strip length change.
+ */
+uint32_t ws2812_get_setup_gen(ws2812_t *cfg)
+{
+    return cfg->setup_gen;
+}
+
+/* Number of pixels encoded and skipped as unchanged since the last call. */
+void ws2812_get_encode_stats(ws2812_t *cfg, uint32_t *encoded,
+                             uint32_t *skipped)
+{
+    *encoded = cfg->pix_encoded;
+    *skipped = cfg->pix_skipped;
 
-    if(sec % 2 == 0){
-        /* upward slope */
-        slope = val * (uint32_t)((255 << 8) - (uint16_t)(sat * (256 - hue)));
-    } else {
-        /* downward slope */
-        slope = val * (uint32_t)((255 << 8) - (uint16_t)(sat * hue));
+    cfg->pix_encoded = 0;
+    cfg->pix_skipped = 0;
+}
+
+#if defined(CONFIG_WS2812_DIRTY_TRACKING)
+/* bytes per pixel in the output buffer */
+static size_t pixel_bytes(ws2812_t *cfg)
+{
+    if(raw_output(cfg)){
+        return pixel_colours(cfg->type);
     }
 
-    slope += slope >> 8;    // Error correction
-    slope += val;           // Error correction
-    slope >>= 16;
+    return ws2812_data_len(cfg->type, 1);
+}
 
-    /* move white component to separate led if pixel supports it. */
-    if(type == pixel_rgbw){
-        rgb->white = base;
-        val -= base;
-        slope -= base;
-    }
+/* pixels are compared as a whole, not field by field */
+static inline bool hsv_equal(const hsv_value_t *a, const hsv_value_t *b)
+{
+    return a->hue == b->hue && a->saturation == b->saturation
+           && a->value == b->value;
+}
 
-    switch(sec){
-    case 0:
-        rgb->red = val;
-        rgb->green = slope;
-        rgb->blue = base;
-        break;
-    case 1:
-        rgb->red = slope;
-        rgb->green = val;
-        rgb->blue = base;
-        break;
-    case 2:
-        rgb->red = base;
-        rgb->green = val;
-        rgb->blue = slope;
-        break;
-    case 3:
-        rgb->red = base;
-        rgb->green = slope;
-        rgb->blue = val;
-        break;
-    case 4:
-        rgb->red = slope;
-        rgb->green = base;
-        rgb->blue = val;
-        break;
-    case 5:
-        rgb->red = val;
-        rgb->green = base;
-        rgb->blue = slope;
-        break;
-    }
+static inline bool rgb_equal(const rgb_value_t *a, const rgb_value_t *b)
+{
+    uint32_t x, y;
+
+    memcpy(&x, a, sizeof(x));
+    memcpy(&y, b, sizeof(y));
+
+    return x == y;
 }
 
-void rgb2hsv(rgb_value_t *rgb, hsv_value_t *hsv)
+/*
+ * Compare the new frame against the last one and tag changed pixels with the
+ * current generation. Pixels past the end of the frame are turned off.
+ */
+static void update_dirty(ws2812_t *cfg, const hsv_value_t hsv[],
+                         const rgb_value_t rgb[], size_t len)
 {
-    uint16_t r, g, b, hue, sat, val, chr, min, max;
-    int32_t tmp;        // Intermediate result
-
-    r = SCALE_UP(rgb->red)   / 255;
-    g = SCALE_UP(rgb->green) / 255;
-    b = SCALE_UP(rgb->blue)  / 255;
-    min = min(r, g);
-    min = min(min, b);
-    max = max(r, g);
-    max = max(max, b);
-
-    val = max;
-    chr = max - min;
-
-    if(chr == 0){
-        hue = 0;
-    } else if(max == r){
-        tmp = SCALE_UP(g - b) / chr;
-        if(tmp < 0){
-            hue = HSV_HUE_STEPS;
-        } else {
-            hue = HSV_HUE_MIN;
+    static const hsv_value_t hsv_off;
+    static const rgb_value_t rgb_off;
+    size_t i;
+
+    /* switching between HSV and RGB frames invalidates the shadow copy */
+    if((rgb != NULL) != cfg->shadow_is_rgb){
+        cfg->shadow_is_rgb = (rgb != NULL);
+        invalidate_buffers(cfg);
+    }
+
+    ++cfg->generation;
+
+    /* one loop per pixel type, so the compare is a few loads */
+    len = min(len, (size_t) cfg->strip_len);
+    if(rgb != NULL){
+        for(i = 0; i < cfg->strip_len; ++i){
+            const rgb_value_t *src = (i < len) ? &rgb[i] : &rgb_off;
+
+            if(!rgb_equal(src, &cfg->shadow_rgb[i])){
+                cfg->shadow_rgb[i] = *src;
+                cfg->pix_gen[i] = cfg->generation;
+            }
         }
-        hue += SCALE_DOWN(tmp * HSV_HUE_SEXTANT);
-    } else if(max == g){
-        tmp = SCALE_UP(b - r) / chr;
-        hue = HSV_GREEN + SCALE_DOWN(tmp * HSV_HUE_SEXTANT);
     } else {
-        tmp = SCALE_UP(r - g) / chr;
-        hue = HSV_BLUE + SCALE_DOWN(tmp * HSV_HUE_SEXTANT);
+        for(i = 0; i < cfg->strip_len; ++i){
+            const hsv_value_t *src = (i < len) ? &hsv[i] : &hsv_off;
+
+            if(!hsv_equal(src, &cfg->shadow[i])){
+                cfg->shadow[i] = *src;
+                cfg->pix_gen[i] = cfg->generation;
+            }
+        }
     }
+}
 
-    if(val == 0){
-        sat = 0;
-    } else {
-        sat = SCALE_UP(chr) / val;
+/* encode len pixels from the shadow frame, starting at pixel idx */
+static uint8_t *encode_shadow(ws2812_t *cfg, uint8_t *dst, size_t idx,
+                              size_t len)
+{
+    cfg->enc_pos = idx;
+    if(cfg->shadow_is_rgb){
+        return cfg->encode_rgb(cfg, dst, &(cfg->shadow_rgb[idx]), len);
     }
 
-    hsv->hue = hue;
-    hsv->value = SCALE_DOWN(HSV_VAL_MAX * val);
-    hsv->saturation = SCALE_DOWN(HSV_SAT_MAX * sat);
+    return cfg->encode(cfg, dst, &(cfg->shadow[idx]), len);
 }
 
-/* convert an RGB byte into the data stream with 2 bits per byte */
-static uint8_t *rgb2pwm(uint8_t *dst, const uint8_t colour)
+/*
+ * Bring the buffer up to date with the shadow frame. Only pixels that changed
+ * since the buffer was last filled get encoded again, the rest of the data
+ * including the reset pulse is still valid.
+ */
+static void encode_dirty(ws2812_t *cfg, tx_buffer_t *tx_buff)
 {
-    unsigned int cnt;
-    uint32_t data = colour;
+    uint8_t *start, *bufp;
+    size_t idx, run, stride, encoded;
 
-    for(cnt = 0; cnt < 4; ++cnt){
-        switch (data & 0xC0) {
-        case 0x00:
-            *dst = WS_BITS_00;
-            break;
-        case 0x40:
-            *dst = WS_BITS_01;
-            break;
-        case 0x80:
-            *dst = WS_BITS_10;
-            break;
-        case 0xC0:
-            *dst = WS_BITS_11;
-            break;
-        }
+    start = encode_start(cfg, tx_buff->buff);
 
-        dst++;
-        data <<= 2;
+    if(tx_buff->gen < cfg->min_gen){
+        bufp = encode_shadow(cfg, start, 0, cfg->strip_len);
+        bufp = encode_reset(cfg, bufp);
+
+        tx_buff->trans.length = (bufp - tx_buff->buff) * 8;
+        tx_buff->gen = cfg->generation;
+        cfg->pix_encoded += cfg->strip_len;
+
+        return;
     }
 
-    return dst;
-}
+    stride = pixel_bytes(cfg);
+    encoded = 0;
+    idx = 0;
+    while(idx < cfg->strip_len){
+        if(cfg->pix_gen[idx] <= tx_buff->gen){
+            ++idx;
+            continue;
+        }
 
-esp_err_t ws2812_send(tx_buffer_t *buffer)
-{
-    ws2812_t *cfg;
-    spi_transaction_t *trans;
-    esp_err_t result;
+        /* encode runs of changed pixels in one go */
+        run = 1;
+        while(idx + run < cfg->strip_len
+              && cfg->pix_gen[idx + run] > tx_buff->gen){
+            ++run;
+        }
 
-    result = 0;
-    if(buffer == NULL){
-        ESP_LOGE(TAG, "[%s] DMA buffer invalid\n", __func__);
-        result = ESP_FAIL;
-        goto err_out;
-    }
-    trans = &(buffer->trans);
-    memset(trans, 0x0, sizeof(*trans));
-    
-    cfg = buffer->cfg;
-    trans->tx_buffer = buffer->buff;
-    trans->length = ws2812_dmabuf_len(cfg->type, cfg->strip_len) * 8;
-    trans->user = buffer;
-    result = spi_device_queue_trans(cfg->spi_master, trans, portMAX_DELAY);
-    if(result != ESP_OK){
-        ESP_LOGE(TAG, "[%s] spi_device_queue_trans() failed: %s.",
-                __func__, esp_err_to_name(result));
-        goto err_out;
+        (void) encode_shadow(cfg, start + idx * stride, idx, run);
+
+        encoded += run;
+        idx += run;
     }
 
-err_out:
-    return result;
+    tx_buff->gen = cfg->generation;
+    cfg->pix_encoded += encoded;
+    cfg->pix_skipped += cfg->strip_len - encoded;
 }
+#endif // defined(CONFIG_WS2812_DIRTY_TRACKING)
 
-esp_err_t ws2812_prepare(ws2812_t *cfg, hsv_value_t hsv_values[],
-                         size_t strip_len, tx_buffer_t **buffer)
+/* Encode either HSV or RGB values into the next free buffer. */
+static esp_err_t prepare(ws2812_t *cfg, const hsv_value_t hsv_values[],
+                         const rgb_value_t rgb_values[], size_t strip_len,
+                         tx_buffer_t **buffer)
 {
     tx_buffer_t *tx_buff;
     uint8_t *bufp;
     size_t len;
-    unsigned int i;
-    rgb_value_t rgb;
     BaseType_t status;
     esp_err_t result;
 
     result = ESP_OK;
 
+#if defined(CONFIG_WS2812_STREAMING)
+    if(cfg->backend == ws2812_spi){
+        result = stream_prepare(cfg, hsv_values, rgb_values, strip_len,
+                                buffer);
+        goto err_out;
+    }
+#endif
+
     status = xQueueReceive(cfg->free_queue, &tx_buff, portMAX_DELAY);
     if(status != pdTRUE){
         ESP_LOGE(TAG, "[%s] Error fetching buffer.", __func__);
@@ -274,80 +1394,93 @@ esp_err_t ws2812_prepare(ws2812_t *cfg, hsv_value_t hsv_values[],
     /* make sure that we do not exceed the buffer */
     len = min(strip_len, cfg->strip_len);
 
-    bufp = tx_buff->buff;
+#if defined(CONFIG_WS2812_DIRTY_TRACKING)
+    update_dirty(cfg, hsv_values, rgb_values, len);
+    encode_dirty(cfg, tx_buff);
+    update_power(cfg);
 
-    /* copy pixel data into DMA buffer */
-    for(i = 0; i < len; ++i){
-        hsv2rgb(&hsv_values[i], &rgb, cfg->type);
+    *buffer = tx_buff;
+    goto err_out;
+#endif
 
-        switch(cfg->type){
-        case pixel_grb:
-            bufp = rgb2pwm(bufp, rgb.green);
-            bufp = rgb2pwm(bufp, rgb.red);
-            bufp = rgb2pwm(bufp, rgb.blue);
-            break;
-        case pixel_rgb:
-            bufp = rgb2pwm(bufp, rgb.red);
-            bufp = rgb2pwm(bufp, rgb.green);
-            bufp = rgb2pwm(bufp, rgb.blue);
-            break;
-        case pixel_rgbw:
-            bufp = rgb2pwm(bufp, rgb.red);
-            bufp = rgb2pwm(bufp, rgb.green);
-            bufp = rgb2pwm(bufp, rgb.blue);
-            bufp = rgb2pwm(bufp, rgb.white);
-            break;
-        default:
-            ESP_LOGE(TAG, "Undefined Pixel Type.");
-            (void) xQueueSend(cfg->free_queue, &(tx_buff), portMAX_DELAY);
-            result = ESP_ERR_INVALID_ARG;
-            goto err_out;
-        }
+    /* copy pixel data into DMA buffer */
+    bufp = encode_start(cfg, tx_buff->buff);
+    cfg->enc_pos = 0;
+    if(rgb_values != NULL){
+        bufp = cfg->encode_rgb(cfg, bufp, rgb_values, len);
+    } else {
+        bufp = cfg->encode(cfg, bufp, hsv_values, len);
     }
+    cfg->pix_encoded += len;
 
     /* turn unused pixels at end of strip off */
     if(cfg->strip_len > len){
-        memset(bufp, WS_BITS_00, ws2812_data_len(cfg->type, cfg->strip_len - len));
-        bufp += ws2812_data_len(cfg->type, cfg->strip_len - len);
+        bufp = encode_off(cfg, bufp, cfg->strip_len - len);
+        clear_power(cfg, len, cfg->strip_len - len);
     }
 
     /* add reset pulse */
-    memset(bufp, WS_BITS_RESET, WS2812_RESET_LEN);
+    bufp = encode_reset(cfg, bufp);
+    update_power(cfg);
 
-    tx_buff->cfg = cfg;
+    /*
+     * The buffer carries its own length, so a strip length change will not
+     * affect frames already prepared.
+     */
+    tx_buff->trans.length = (bufp - tx_buff->buff) * 8;
     *buffer = tx_buff;
 
 err_out:
     return result;
 }
 
-ws2812_t *ws2812_init(uint16_t strip_len, enum pixel_type type)
+esp_err_t ws2812_prepare(ws2812_t *cfg, hsv_value_t hsv_values[],
+                         size_t strip_len, tx_buffer_t **buffer)
+{
+    return prepare(cfg, hsv_values, NULL, strip_len, buffer);
+}
+
+/*
+ * Same as ws2812_prepare(), but takes RGB(W) values. Saves the HSV conversion
+ * for content that is RGB in the first place. The white channel is only used
+ * for RGBW pixels.
+ */
+esp_err_t ws2812_prepare_rgb(ws2812_t *cfg, rgb_value_t rgb_values[],
+                             size_t strip_len, tx_buffer_t **buffer)
+{
+    return prepare(cfg, NULL, rgb_values, strip_len, buffer);
+}
+
+static esp_err_t spi_init(ws2812_t *cfg)
 {
-    unsigned int i;
     esp_err_t result;
-    ws2812_t *cfg = NULL;
     gpio_config_t gpio_cfg;
     spi_bus_config_t buscfg = {
          .miso_io_num = -1,
-         .mosi_io_num = CONFIG_WS2812_DATA_PIN,
+         .mosi_io_num = cfg->data_pin,
          .sclk_io_num = -1,
          .quadwp_io_num = -1,
          .quadhd_io_num = -1,
-         .max_transfer_sz = ws2812_dmabuf_len(type, CONFIG_WS2812_MAX_LEDS),
+         .max_transfer_sz = buffer_len(cfg, cfg->max_len),
     };
     spi_device_interface_config_t devcfg = {
-        .clock_speed_hz = SCLK_FREQ,
+        .clock_speed_hz = WS2812_SCLK_FREQ,
         .command_bits = 0,
         .address_bits = 0,
         .mode = 0,
         .spics_io_num = -1,
-        .queue_size = 2,
+        .queue_size = NUM_DMA_BUFFS,
         .post_cb = trans_done_cb,
     };
 
-    result = 0;
+    /* Clocked LEDs get a real clock line and can run much faster. */
+    if(cfg->type == pixel_apa102){
+        buscfg.sclk_io_num = cfg->clock_pin;
+        devcfg.clock_speed_hz = cfg->clock_hz;
+    }
+
     memset(&gpio_cfg, 0x0, sizeof(gpio_cfg));
-    gpio_cfg.pin_bit_mask = (1LL << CONFIG_WS2812_DATA_PIN);
+    gpio_cfg.pin_bit_mask = (1LL << cfg->data_pin);
     gpio_cfg.mode = GPIO_MODE_OUTPUT;
     gpio_cfg.pull_up_en = GPIO_PULLUP_DISABLE;
     gpio_cfg.pull_down_en = GPIO_PULLDOWN_ENABLE;
@@ -359,6 +1492,94 @@ ws2812_t *ws2812_init(uint16_t strip_len, enum pixel_type type)
         goto err_out;
     }
 
+    init_pwm_lut();
+
+    result = spi_bus_initialize(cfg->spi_host, &buscfg, SPI_DMA_CH_AUTO);
+    if(result != ESP_OK){
+        ESP_LOGE(TAG, "[%s] spi_bus_initialize() failed: %s.",
+                __func__, esp_err_to_name(result));
+        goto err_out;
+    }
+
+    result = spi_bus_add_device(cfg->spi_host, &devcfg, &(cfg->spi_master));
+    if(result != ESP_OK){
+        ESP_LOGE(TAG, "[%s] spi_bus_add_device() failed: %s.",
+                __func__, esp_err_to_name(result));
+        goto err_out;
+    }
+
+#if defined(CONFIG_WS2812_INVERT_SPI)
+    if(cfg->type != pixel_apa102){
+        GPIO.func_out_sel_cfg[cfg->data_pin].inv_sel = 1;
+    }
+#endif
+
+err_out:
+    return result;
+}
+
+/*
+ * Allocate the buffer pool for the maximum strip length. Buffers are never
+ * reallocated afterwards, so length changes do not touch the heap.
+ */
+static esp_err_t pool_init(ws2812_t *cfg)
+{
+    unsigned int i;
+    tx_buffer_t *tx_buff;
+    uint32_t caps;
+    size_t len;
+    esp_err_t result;
+
+    result = ESP_OK;
+
+    /* RMT driver copies the data itself, so any memory will do */
+    caps = raw_output(cfg) ? MALLOC_CAP_8BIT : MALLOC_CAP_DMA;
+    len = buffer_len(cfg, cfg->max_len);
+
+    for(i = 0; i < NUM_DMA_BUFFS; ++i){
+        tx_buff = &(cfg->tx_buffers[i]);
+
+        tx_buff->buff = heap_caps_malloc(len, caps);
+        if(tx_buff->buff == NULL){
+            ESP_LOGE(TAG, "[%s] Allocating %zu bytes for buffer %u failed.",
+                    __func__, len, i);
+            result = ESP_ERR_NO_MEM;
+            goto err_out;
+        }
+
+        memset(&(tx_buff->trans), 0x0, sizeof(tx_buff->trans));
+        tx_buff->trans.tx_buffer = tx_buff->buff;
+        tx_buff->trans.user = tx_buff;
+        tx_buff->cfg = cfg;
+
+        (void) xQueueSend(cfg->free_queue, &tx_buff, 0);
+    }
+
+err_out:
+    return result;
+}
+
+/*
+ * Create an output as described by the output config. Several outputs can be
+ * used at the same time, as long as they do not share an SPI host or RMT
+ * channel. The strip length is set to the maximum length.
+ */
+ws2812_t *ws2812_init_output(const ws2812_output_t *output)
+{
+    unsigned int i;
+    esp_err_t result;
+    ws2812_t *cfg = NULL;
+
+    result = 0;
+
+    if(output == NULL || output->max_len > CONFIG_WS2812_MAX_LEDS
+       || (output->backend == ws2812_sink && output->sink == NULL))
+    {
+        ESP_LOGE(TAG, "[%s] Invalid output config.", __func__);
+        result = ESP_ERR_INVALID_ARG;
+        goto err_out;
+    }
+
     cfg = calloc(1, sizeof(*cfg));
     if(cfg == NULL){
         ESP_LOGE(TAG, "[%s] malloc for cfg failed\n", __func__);
@@ -366,7 +1587,59 @@ ws2812_t *ws2812_init(uint16_t strip_len, enum pixel_type type)
         goto err_out;
     }
 
-    cfg->type = type;
+    cfg->type = output->type;
+    cfg->backend = output->backend;
+    cfg->max_len = output->max_len;
+    cfg->data_pin = output->data_pin;
+    cfg->clock_pin = output->clock_pin;
+    cfg->clock_hz = output->clock_hz;
+    cfg->spi_host = output->spi_host;
+    cfg->rmt_channel = output->rmt_channel;
+    cfg->sink = output->sink;
+    cfg->sink_priv = output->sink_priv;
+    cfg->apa102_hdr = APA102_HEADER | APA102_BRIGHT_MAX;
+
+#if defined(CONFIG_WS2812_DIRTY_TRACKING)
+    /* HSV and RGB frames share the shadow copy, so size it for the larger */
+    cfg->shadow = calloc(cfg->max_len, max(sizeof(hsv_value_t),
+                                           sizeof(rgb_value_t)));
+    cfg->pix_gen = calloc(cfg->max_len, sizeof(*cfg->pix_gen));
+    if(cfg->shadow == NULL || cfg->pix_gen == NULL){
+        ESP_LOGE(TAG, "[%s] Allocating shadow frame failed.", __func__);
+        result = ESP_ERR_NO_MEM;
+        goto err_out;
+    }
+#endif
+
+#if defined(CONFIG_WS2812_DITHER)
+    cfg->dither = calloc(cfg->max_len, sizeof(*cfg->dither));
+    if(cfg->dither == NULL){
+        ESP_LOGE(TAG, "[%s] Allocating dither state failed.", __func__);
+        result = ESP_ERR_NO_MEM;
+        goto err_out;
+    }
+#endif
+
+#if defined(CONFIG_WS2812_POWER_LIMIT)
+    cfg->pix_power = calloc(cfg->max_len, sizeof(*cfg->pix_power));
+    if(cfg->pix_power == NULL){
+        ESP_LOGE(TAG, "[%s] Allocating power shares failed.", __func__);
+        result = ESP_ERR_NO_MEM;
+        goto err_out;
+    }
+
+    cfg->power_limit = POWER_LIMIT_ONE;
+    cfg->power_budget = CONFIG_WS2812_POWER_BUDGET_MA;
+#endif
+
+    /* start with a linear response at full brightness */
+    (void) ws2812_set_correction(cfg, NULL, NULL, HSV_VAL_MAX);
+
+    result = set_encoders(cfg);
+    if(result != ESP_OK){
+        ESP_LOGE(TAG, "[%s] Undefined Pixel Type.", __func__);
+        goto err_out;
+    }
 
     cfg->lock = xSemaphoreCreateMutex();
     if(cfg->lock == NULL){
@@ -382,25 +1655,28 @@ ws2812_t *ws2812_init(uint16_t strip_len, enum pixel_type type)
         goto err_out;
     }
 
-    result = spi_bus_initialize(SPI2_HOST, &buscfg, SPI_DMA_CH_AUTO);
+    switch(cfg->backend){
+    case ws2812_spi:
+        result = spi_init(cfg);
+        break;
+    case ws2812_rmt:
+        result = ws2812_rmt_init(cfg);
+        break;
+    case ws2812_sink:
+        /* nothing to set up */
+        break;
+    }
+
     if(result != ESP_OK){
-        ESP_LOGE(TAG, "[%s] spi_bus_initialize() failed: %s.",
-                __func__, esp_err_to_name(result));
         goto err_out;
     }
 
-    result = spi_bus_add_device(SPI2_HOST, &devcfg, &(cfg->spi_master));
+    result = pool_init(cfg);
     if(result != ESP_OK){
-        ESP_LOGE(TAG, "[%s] spi_bus_add_device() failed: %s.",
-                __func__, esp_err_to_name(result));
         goto err_out;
     }
 
-#if defined(CONFIG_WS2812_INVERT_SPI)
-    GPIO.func_out_sel_cfg[CONFIG_WS2812_DATA_PIN].inv_sel = 1;
-#endif
-
-    result = ws2812_set_len(cfg, strip_len);
+    result = ws2812_set_len(cfg, cfg->max_len);
     if(result != ESP_OK){
         ESP_LOGE(TAG, "[%s] ws2812_set_len() failed: %s.",
                 __func__, esp_err_to_name(result));
@@ -431,6 +1707,21 @@ err_out:
             (void) spi_bus_remove_device(cfg->spi_master);
         }
 
+        if(cfg->rmt_installed){
+            ws2812_rmt_deinit(cfg);
+        }
+
+#if defined(CONFIG_WS2812_DIRTY_TRACKING)
+        free(cfg->shadow);
+        free(cfg->pix_gen);
+#endif
+#if defined(CONFIG_WS2812_DITHER)
+        free(cfg->dither);
+#endif
+#if defined(CONFIG_WS2812_POWER_LIMIT)
+        free(cfg->pix_power);
+#endif
+
         if(cfg != NULL){
             free(cfg);
         }
@@ -440,15 +1731,73 @@ err_out:
     return cfg;
 }
 
+/* Create the default output as configured via Kconfig. */
+ws2812_t *ws2812_init(uint16_t strip_len, enum pixel_type type)
+{
+    ws2812_t *cfg;
+    esp_err_t result;
+    ws2812_output_t output = {
+#if defined(CONFIG_WS2812_BACKEND_RMT)
+        .backend = ws2812_rmt,
+        .rmt_channel = CONFIG_WS2812_RMT_CHANNEL,
+#else
+        .backend = ws2812_spi,
+        .spi_host = SPI2_HOST,
+#endif
+        .type = type,
+        .max_len = CONFIG_WS2812_MAX_LEDS,
+        .data_pin = CONFIG_WS2812_DATA_PIN,
+#if defined(CONFIG_BLINKEN_TYPE_APA102)
+        .clock_pin = CONFIG_WS2812_CLOCK_PIN,
+        .clock_hz = CONFIG_APA102_CLOCK_FREQ,
+#else
+        .clock_pin = -1,
+#endif
+    };
+
+    if(strip_len > CONFIG_WS2812_MAX_LEDS){
+        ESP_LOGE(TAG, "[%s] Strip too long for DMA buffer\n", __func__);
+        return NULL;
+    }
+
+    cfg = ws2812_init_output(&output);
+    if(cfg != NULL && strip_len != cfg->max_len){
+        result = ws2812_set_len(cfg, strip_len);
+        if(result != ESP_OK){
+            ESP_LOGE(TAG, "[%s] ws2812_set_len() failed: %s.",
+                    __func__, esp_err_to_name(result));
+        }
+    }
+
+    return cfg;
+}
+
+/* initialise LEDs to off and add reset pulse at end of strip */
+static void blank_buffer(ws2812_t *cfg, tx_buffer_t *tx_buff)
+{
+#if defined(CONFIG_WS2812_STREAMING)
+    /* segments are encoded just before sending, nothing to do here */
+    tx_buff->trans.length = 0;
+#else
+    uint8_t *bufp;
+
+    bufp = encode_start(cfg, tx_buff->buff);
+    bufp = encode_off(cfg, bufp, cfg->strip_len);
+    bufp = encode_reset(cfg, bufp);
+
+    tx_buff->trans.length = (bufp - tx_buff->buff) * 8;
+#endif
+}
+
 esp_err_t ws2812_set_len(ws2812_t *cfg, uint16_t strip_len)
 {
-    unsigned int i;
+    unsigned int i, drained;
     esp_err_t result;
     BaseType_t status;
-    tx_buffer_t *tx_buff;
-    uint32_t reset_off;
+    tx_buffer_t *pool[NUM_DMA_BUFFS];
 
     result = ESP_OK;
+    drained = 0;
 
     if(cfg == NULL){
         ESP_LOGE(TAG, "[%s] no config given\n", __func__);
@@ -456,6 +1805,12 @@ esp_err_t ws2812_set_len(ws2812_t *cfg, uint16_t strip_len)
         goto err_out;
     }
 
+    if(strip_len > cfg->max_len){
+        ESP_LOGE(TAG, "[%s] Strip too long for DMA buffer\n", __func__);
+        result = ESP_FAIL;
+        goto err_out;
+    }
+
     /* lock the config mutex */
     status = xSemaphoreTake(cfg->lock, configTICK_RATE_HZ);
     if(status != pdTRUE){
@@ -464,80 +1819,61 @@ esp_err_t ws2812_set_len(ws2812_t *cfg, uint16_t strip_len)
         goto err_out;
     }
 
-    (void) xQueueReset(cfg->free_queue);
-
-    if(strip_len <= CONFIG_WS2812_MAX_LEDS){
-        cfg->strip_len = strip_len;
-        reset_off = ws2812_dmabuf_len(cfg->type, strip_len) - WS2812_RESET_LEN;
-
-        for(i = 0; i < NUM_DMA_BUFFS; ++i){
-            tx_buff = &(cfg->tx_buffers[i]);
+    /*
+     * Collect all buffers from the free queue. Buffers still being sent out
+     * will be handed back by the transfer done call-back, so this also waits
+     * for the current frame to finish.
+     */
+    for(drained = 0; drained < NUM_DMA_BUFFS; ++drained){
+        status = xQueueReceive(cfg->free_queue, &(pool[drained]),
+                               configTICK_RATE_HZ);
+        if(status != pdTRUE){
+            ESP_LOGE(TAG, "[%s] Timeout waiting for buffers to drain.",
+                    __func__);
+            result = ESP_ERR_TIMEOUT;
+            goto err_unlock;
+        }
+    }
 
-            if(tx_buff->buff != NULL){
-                free(tx_buff->buff);
-            }
+    cfg->strip_len = strip_len;
+    clear_power(cfg, strip_len, cfg->max_len - strip_len);
 
-            tx_buff->buff = malloc(ws2812_dmabuf_len(cfg->type, strip_len));
-            if(tx_buff->buff == NULL){
-                result = ESP_ERR_NO_MEM;
-                goto err_out;
-            }
+    for(i = 0; i < NUM_DMA_BUFFS; ++i){
+        blank_buffer(cfg, pool[i]);
+    }
 
-            /* initialise LEDs to off and add reset pulse at end of strip */
-            memset(tx_buff->buff, WS_BITS_00, reset_off);
-            memset(&(tx_buff->buff[reset_off]), WS_BITS_RESET, WS2812_RESET_LEN);
+    /* reset pulse has moved, so all buffers need a full encode */
+    invalidate_buffers(cfg);
 
-            status = xQueueSend(cfg->free_queue, &(tx_buff), portMAX_DELAY);
-            if(status != pdTRUE){
-                result = ESP_FAIL;
-                goto err_out;
-            }
-        }
-    } else {
-        ESP_LOGE(TAG, "[%s] Strip too long for DMA buffer\n", __func__);
-        result = ESP_FAIL;
+err_unlock:
+    /* hand back whatever we got hold of */
+    for(i = 0; i < drained; ++i){
+        (void) xQueueSend(cfg->free_queue, &(pool[i]), 0);
     }
 
     xSemaphoreGive(cfg->lock);
 
 err_out:
-    if(result != ESP_OK){
-        (void) xQueueReset(cfg->free_queue);
-
-        for(i = 0; i < NUM_DMA_BUFFS; i++){
-            if(cfg->tx_buffers[i].buff != NULL){
-                free(cfg->tx_buffers[i].buff);
-                cfg->tx_buffers[i].buff = NULL;
-            }
-        }
-    }
     return result;
 }
 
 size_t ws2812_data_len(enum pixel_type type, uint16_t len)
 {
-    unsigned int colours;
-
-    switch(type){
-    case pixel_rgbw:
-        colours = 4;
-        break;
-    case pixel_rgb:
-    default:
-        colours = 3;
-        break;
+    /* APA102 pixels are sent as they are. */
+    if(type == pixel_apa102){
+        return len * pixel_colours(type);
     }
 
     /*
-     * We have three or four RGB(W) bytes per LED and need to send out four
-     * bits on SPI to transmit one bit to the WS2812.
+     * We have three or four RGB(W) bytes per LED and need to send out three
+     * or four bits on SPI to transmit one bit to the WS2812.
      */
-    return len * colours * 4;
+    return len * pixel_colours(type) * WS2812_SPI_BITS;
 }
 
 size_t ws2812_dmabuf_len(enum pixel_type type, uint16_t len)
 {
-     /* Add length of reset signal to data length. */
-    return ws2812_data_len(type, len) + WS2812_RESET_LEN;
+     /* Add length of start frame and reset signal to data length. */
+    return ws2812_data_len(type, len) + frame_overhead(type, len);
 }
 
@@ -21,35 +21,64 @@
 #define __WS2812_H__
 
 #include <stdbool.h>
+#include <stdatomic.h>
 #include <freertos/FreeRTOS.h>
 #include <freertos/event_groups.h>
 #include <freertos/semphr.h>
 #include <driver/spi_master.h>
+#include <driver/rmt.h>
 
 /*
- * WS2812 bit period is 1.25us. We need to send out four bits to form the
- * high-low signal, so one SPI bit takes 0.25us. According to the data sheets,
- * the reset signal is 50us low, but various sources claim that latching
- * happens at around ~10us. To be on the safe side, we will use 20us, so we
- * need to send out 80 bits. 
+ * WS2812 bit period is 1.25us. We need to send out three or four bits to
+ * form the high-low signal, so one SPI bit takes 0.42us or 0.25us. According
+ * to the data sheets, the reset signal is 50us low, but various sources claim
+ * that latching happens at around ~10us. To be on the safe side, we will hold
+ * the line low for 64us, which is 160 SPI bits in 4-bit mode.
  */
-#define WS2812_RESET_LEN        (160 / 8)
+#if defined(CONFIG_WS2812_ENCODING_3BIT)
+#define WS2812_SPI_BITS         3
+#define WS2812_SCLK_FREQ        2400000 // three "bits per bit" -> 800kHz
+#else
+#define WS2812_SPI_BITS         4
+#define WS2812_SCLK_FREQ        2500000 // four "bits per bit" -> 800kHz
+#endif // defined(CONFIG_WS2812_ENCODING_3BIT)
 
-/* We send two WS2812-bits per byte, one bit per nibble. */
-#if defined(CONFIG_WS2812_INVERT_SPI)
-#define WS_BITS_00              0x77 /* -___-___ */
-#define WS_BITS_01              0x71 /* -___---_ */
-#define WS_BITS_10              0x17 /* ---_-___ */
-#define WS_BITS_11              0x11 /* ---_---_ */
-#define WS_BITS_RESET           0xff /* ________ */
+#define WS2812_RESET_US         64
+#define WS2812_RESET_LEN        \
+    ((WS2812_RESET_US * (WS2812_SCLK_FREQ / 100000) / 10 + 7) / 8)
+
+#if defined(CONFIG_WS2812_ENCODING_3BIT)
+/*
+ * One WS2812-bit per three SPI bits, so a colour byte turns into exactly
+ * three bytes, but single bits straddle the byte boundaries.
+ */
+#define WS_BIT_0                0x4  /* -__ */
+#define WS_BIT_1                0x6  /* --_ */
 #else
+/* We send two WS2812-bits per byte, one bit per nibble. */
 #define WS_BITS_00              0x88 /* -___-___ */
 #define WS_BITS_01              0x8e /* -___---_ */
 #define WS_BITS_10              0xe8 /* ---_-___ */
 #define WS_BITS_11              0xee /* ---_---_ */
+#endif // defined(CONFIG_WS2812_ENCODING_3BIT)
 #define WS_BITS_RESET           0x00 /* ________ */
+
+/* Bit mask applied to the whole data stream before it is sent out. */
+#if defined(CONFIG_WS2812_INVERT_SPI)
+#define WS_BITS_INVERT          0xff
+#else
+#define WS_BITS_INVERT          0x00
 #endif // defined(CONFIG_WS2812_INVERT_SPI)
 
+/*
+ * APA102/SK9822 are clocked, so pixel data goes out as it is. Each frame
+ * starts with 32 zero bits, every pixel is a 32 bit word made up of a header
+ * byte carrying the 5-bit global brightness followed by blue, green and red.
+ */
+#define APA102_FRAME_LEN        4
+#define APA102_HEADER           0xe0
+#define APA102_BRIGHT_MAX       0x1f
+
 typedef struct {
     uint8_t     red;
     uint8_t     green;
@@ -69,15 +98,56 @@ typedef struct {
     spi_transaction_t trans;
     ws2812_t *cfg;
     uint8_t *buff;
+    bool last;          // last segment of a frame in streaming mode
+    uint32_t gen;       // generation of the pixels last encoded into buff
 } tx_buffer_t;
 
 #define NUM_DMA_BUFFS   3
 enum pixel_type {
     pixel_rgb,
     pixel_grb,
-    pixel_rgbw
+    pixel_rgbw,
+    pixel_apa102
 };
 
+enum ws2812_backend {
+    ws2812_spi,
+    ws2812_rmt,
+    ws2812_sink
+};
+
+/* Receives the raw colour bytes of each frame sent to a sink output. */
+typedef void (*ws2812_sink_fn)(ws2812_t *cfg, const uint8_t *data,
+                               size_t len, void *priv);
+
+/* Configuration of one output, see ws2812_init_output(). */
+typedef struct {
+    enum ws2812_backend backend;
+    enum pixel_type     type;
+    uint16_t            max_len;        // buffers are sized for this many LEDs
+    int                 data_pin;
+    int                 clock_pin;      // APA102 only
+    int                 clock_hz;       // APA102 only
+    spi_host_device_t   spi_host;       // SPI backend only
+    rmt_channel_t       rmt_channel;    // RMT backend only
+    ws2812_sink_fn      sink;           // sink backend only
+    void               *sink_priv;
+} ws2812_output_t;
+
+/*
+ * Per LED colour gains, applied after gamma correction. A channel is scaled
+ * by (gain + 1) / 256, so 0xff leaves it untouched.
+ */
+typedef struct {
+    uint8_t gain[4];    // red, green, blue, white
+} ws2812_calib_t;
+
+/* Converts len pixels into the output buffer, returns end of data. */
+typedef uint8_t *(*encode_fn)(ws2812_t *cfg, uint8_t *dst,
+                              const hsv_value_t hsv[], size_t len);
+typedef uint8_t *(*encode_rgb_fn)(ws2812_t *cfg, uint8_t *dst,
+                                  const rgb_value_t rgb[], size_t len);
+
 typedef struct _ws2812 {
     spi_device_handle_t spi_master;
     EventGroupHandle_t *events;
@@ -85,7 +155,70 @@ typedef struct _ws2812 {
     QueueHandle_t       free_queue;
     tx_buffer_t         tx_buffers[NUM_DMA_BUFFS];
     uint16_t            strip_len;
+    uint16_t            max_len;
     enum pixel_type     type;
+    enum ws2812_backend backend;
+    int                 data_pin;
+    int                 clock_pin;
+    int                 clock_hz;
+    spi_host_device_t   spi_host;
+    ws2812_sink_fn      sink;
+    void               *sink_priv;
+    encode_fn           encode;
+    encode_rgb_fn       encode_rgb;
+    uint32_t            apa102_hdr;     // APA102 header incl. brightness
+    /* brightness and gamma correction, see ws2812_set_correction() */
+#if defined(CONFIG_WS2812_DITHER)
+    uint16_t            gamma16[257];
+    uint32_t            bright_scale;
+    uint8_t           (*dither)[4];     // carried error, max_len pixels
+#else
+    uint8_t             value_lut[256];
+#endif
+    size_t              enc_pos;        // first pixel of current encoder run
+    const uint8_t      *lut_gamma;
+    const uint16_t     *lut_gamma16;
+    uint16_t            lut_brightness;
+#if defined(CONFIG_WS2812_CALIBRATION)
+    ws2812_calib_t     *calib;          // max_len gains, NULL if uncalibrated
+#endif
+#if defined(CONFIG_WS2812_POWER_LIMIT)
+    /* current limiter, see ws2812_get_current() */
+    uint32_t           *pix_power;      // per pixel share, max_len pixels
+    uint32_t            power_sum;      // sum of pix_power
+    uint32_t            power_budget;   // mA
+    uint32_t            power_draw;     // mA, estimate for the last frame
+    uint32_t            power_limit;    // POWER_LIMIT_ONE is full level
+#endif
+    /* RMT backend state, see ws2812_rmt.c */
+    rmt_channel_t       rmt_channel;
+    rmt_item32_t        rmt_bit0;
+    rmt_item32_t        rmt_bit1;
+    tx_buffer_t        *rmt_busy;
+    bool                rmt_installed;
+    /* streaming mode state */
+    const hsv_value_t  *stream_src;
+    const rgb_value_t  *stream_rgb;
+    size_t              stream_len;
+    size_t              stream_pos;
+    tx_buffer_t        *stream_buffs[NUM_DMA_BUFFS];
+    unsigned int        stream_ready;
+    atomic_uint         stream_inflight;
+    volatile uint32_t   underruns;
+    /* dirty pixel tracking */
+    uint32_t            generation;     // bumped for each prepared frame
+    uint32_t            min_gen;        // older buffers need a full encode
+    uint32_t            setup_gen;      // bumped when encoder settings change
+#if defined(CONFIG_WS2812_DIRTY_TRACKING)
+    union {                             // last frame, max_len pixels
+        hsv_value_t    *shadow;
+        rgb_value_t    *shadow_rgb;
+    };
+    bool                shadow_is_rgb;
+    uint32_t           *pix_gen;        // generation each pixel changed in
+#endif
+    uint32_t            pix_encoded;
+    uint32_t            pix_skipped;
 } ws2812_t;
 
 
@@ -115,13 +248,59 @@ typedef struct _ws2812 {
 #define HSV_MAGENTA         (5 << HSV_SEXTANT_SHIFT)
 
 ws2812_t *ws2812_init(uint16_t strip_len, enum pixel_type type);
+ws2812_t *ws2812_init_output(const ws2812_output_t *output);
 esp_err_t ws2812_set_len(ws2812_t *cfg, uint16_t strip_len);
 esp_err_t ws2812_deinit(ws2812_t *cfg);
 esp_err_t ws2812_prepare(ws2812_t *cfg, hsv_value_t hsv_values[],
                          size_t strip_len, tx_buffer_t **buffer);
+esp_err_t ws2812_prepare_rgb(ws2812_t *cfg, rgb_value_t rgb_values[],
+                             size_t strip_len, tx_buffer_t **buffer);
 esp_err_t ws2812_send(tx_buffer_t *buffer);
+esp_err_t ws2812_set_brightness(ws2812_t *cfg, uint16_t brightness);
+esp_err_t ws2812_set_correction(ws2812_t *cfg, const uint8_t gamma[256],
+                                const uint16_t gamma16[257],
+                                uint16_t brightness);
+#if defined(CONFIG_WS2812_CALIBRATION)
+esp_err_t ws2812_set_calibration(ws2812_t *cfg, const ws2812_calib_t calib[],
+                                 size_t len);
+esp_err_t ws2812_load_calibration(ws2812_t *cfg, const char *label,
+                                  size_t first);
+#endif
+#if defined(CONFIG_WS2812_POWER_LIMIT)
+esp_err_t ws2812_set_power_budget(ws2812_t *cfg, uint32_t budget);
+uint32_t ws2812_get_current(ws2812_t *cfg);
+#endif
+uint32_t ws2812_get_setup_gen(ws2812_t *cfg);
+void ws2812_get_encode_stats(ws2812_t *cfg, uint32_t *encoded,
+                             uint32_t *skipped);
 size_t ws2812_data_len(enum pixel_type type, uint16_t len);
 size_t ws2812_dmabuf_len(enum pixel_type type, uint16_t len);
+#if defined(CONFIG_WS2812_STREAMING)
+uint32_t ws2812_get_underruns(ws2812_t *cfg);
+#endif
 
+void hsv2rgb_batch(const hsv_value_t *in, rgb_value_t *out, size_t n,
+                   enum pixel_type type);
 void rgb2hsv(rgb_value_t *rgb, hsv_value_t *hsv);
+
+/* RMT output backend */
+#if defined(CONFIG_WS2812_RMT)
+esp_err_t ws2812_rmt_init(ws2812_t *cfg);
+void ws2812_rmt_deinit(ws2812_t *cfg);
+esp_err_t ws2812_rmt_send(tx_buffer_t *buffer);
+#else
+static inline esp_err_t ws2812_rmt_init(ws2812_t *cfg)
+{
+    return ESP_ERR_NOT_SUPPORTED;
+}
+
+static inline void ws2812_rmt_deinit(ws2812_t *cfg)
+{
+}
+
+static inline esp_err_t ws2812_rmt_send(tx_buffer_t *buffer)
+{
+    return ESP_ERR_NOT_SUPPORTED;
+}
+#endif // defined(CONFIG_WS2812_RMT)
 #endif
@@ -0,0 +1,247 @@
+/**
+ * ESP32 Blinkenlights.
+ * Copyright (C) 2019-2022  Tido Klaassen <tido@4gh.eu>
+ *
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston,
+ * MA  02110-1301, USA.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <freertos/FreeRTOS.h>
+#include <freertos/queue.h>
+#include <esp_log.h>
+#include <esp_err.h>
+#include <driver/rmt.h>
+#include "kutils.h"
+#include "ws2812.h"
+
+static const char *TAG = "WS2812_RMT";
+
+/*
+ * The RMT backend sends the plain RGB(W) bytes prepared by ws2812_prepare().
+ * The driver's translator expands them into RMT symbols on the fly while the
+ * hardware drains its memory block in ping-pong fashion, so the amount of
+ * RAM needed does not depend on the strip length beyond the three or four
+ * bytes per pixel.
+ */
+
+/* 80MHz APB / 2 -> 25ns resolution */
+#define RMT_CLK_DIV         2
+
+/* WS2812 bit timings in ns */
+#define WS2812_T0H_NS       350
+#define WS2812_T0L_NS       900
+#define WS2812_T1H_NS       900
+#define WS2812_T1L_NS       350
+
+/*
+ * The driver only supports one TX end call-back for all channels, so remember
+ * which output lives on which channel.
+ */
+static ws2812_t *rmt_outputs[RMT_CHANNEL_MAX];
+static unsigned int rmt_num_outputs = 0;
+
+/* convert RGB(W) bytes into RMT symbols, MSB first. */
+static void IRAM_ATTR rmt_translate(const void *src, rmt_item32_t *dest,
+                                    size_t src_size, size_t wanted_num,
+                                    size_t *translated_size, size_t *item_num)
+{
+    const uint8_t *bytes = src;
+    ws2812_t *cfg;
+    size_t size, num;
+    unsigned int bit;
+
+    *translated_size = 0;
+    *item_num = 0;
+
+    if(src == NULL || dest == NULL){
+        return;
+    }
+
+    if(rmt_translator_get_context(item_num, (void **) &cfg) != ESP_OK){
+        return;
+    }
+
+    size = 0;
+    num = 0;
+    while(size < src_size && num + 8 <= wanted_num){
+        for(bit = 0x80; bit != 0; bit >>= 1){
+            dest->val = (bytes[size] & bit) ? cfg->rmt_bit1.val
+                                            : cfg->rmt_bit0.val;
+            ++dest;
+        }
+
+        num += 8;
+        ++size;
+    }
+
+    *translated_size = size;
+    *item_num = num;
+}
+
+/* hand the buffer back to ws2812_prepare() once it has been sent out. */
+static void IRAM_ATTR rmt_tx_end_cb(rmt_channel_t channel, void *arg)
+{
+    ws2812_t *cfg;
+    tx_buffer_t *buffer;
+
+    if(channel >= RMT_CHANNEL_MAX){
+        return;
+    }
+
+    cfg = rmt_outputs[channel];
+    if(cfg == NULL || cfg->rmt_busy == NULL){
+        return;
+    }
+
+    buffer = cfg->rmt_busy;
+    cfg->rmt_busy = NULL;
+
+    (void) xQueueSendFromISR(cfg->free_queue, &buffer, NULL);
+}
+
+static uint32_t ns_to_ticks(uint32_t clock_hz, uint32_t ns)
+{
+    return (uint32_t) (((uint64_t) clock_hz * ns + 500000000) / 1000000000);
+}
+
+esp_err_t ws2812_rmt_init(ws2812_t *cfg)
+{
+    rmt_config_t rmt_cfg =
+        RMT_DEFAULT_CONFIG_TX(cfg->data_pin, cfg->rmt_channel);
+    uint32_t clock_hz;
+    esp_err_t result;
+
+    if(cfg->rmt_channel >= RMT_CHANNEL_MAX
+       || rmt_outputs[cfg->rmt_channel] != NULL)
+    {
+        ESP_LOGE(TAG, "[%s] RMT channel %d invalid or in use.",
+                __func__, cfg->rmt_channel);
+        result = ESP_ERR_INVALID_STATE;
+        goto err_out;
+    }
+
+    rmt_cfg.clk_div = RMT_CLK_DIV;
+    rmt_cfg.tx_config.idle_output_en = true;
+    rmt_cfg.tx_config.idle_level = RMT_IDLE_LEVEL_LOW;
+
+    result = rmt_config(&rmt_cfg);
+    if(result != ESP_OK){
+        ESP_LOGE(TAG, "[%s] rmt_config() failed: %s.",
+                __func__, esp_err_to_name(result));
+        goto err_out;
+    }
+
+    result = rmt_driver_install(cfg->rmt_channel, 0, 0);
+    if(result != ESP_OK){
+        ESP_LOGE(TAG, "[%s] rmt_driver_install() failed: %s.",
+                __func__, esp_err_to_name(result));
+        goto err_out;
+    }
+    cfg->rmt_installed = true;
+
+    result = rmt_get_counter_clock(cfg->rmt_channel, &clock_hz);
+    if(result != ESP_OK){
+        ESP_LOGE(TAG, "[%s] rmt_get_counter_clock() failed: %s.",
+                __func__, esp_err_to_name(result));
+        goto err_out;
+    }
+
+    cfg->rmt_bit0.level0 = 1;
+    cfg->rmt_bit0.duration0 = ns_to_ticks(clock_hz, WS2812_T0H_NS);
+    cfg->rmt_bit0.level1 = 0;
+    cfg->rmt_bit0.duration1 = ns_to_ticks(clock_hz, WS2812_T0L_NS);
+
+    cfg->rmt_bit1.level0 = 1;
+    cfg->rmt_bit1.duration0 = ns_to_ticks(clock_hz, WS2812_T1H_NS);
+    cfg->rmt_bit1.level1 = 0;
+    cfg->rmt_bit1.duration1 = ns_to_ticks(clock_hz, WS2812_T1L_NS);
+
+    result = rmt_translator_init(cfg->rmt_channel, rmt_translate);
+    if(result != ESP_OK){
+        ESP_LOGE(TAG, "[%s] rmt_translator_init() failed: %s.",
+                __func__, esp_err_to_name(result));
+        goto err_out;
+    }
+
+    result = rmt_translator_set_context(cfg->rmt_channel, cfg);
+    if(result != ESP_OK){
+        ESP_LOGE(TAG, "[%s] rmt_translator_set_context() failed: %s.",
+                __func__, esp_err_to_name(result));
+        goto err_out;
+    }
+
+    rmt_outputs[cfg->rmt_channel] = cfg;
+    if(rmt_num_outputs++ == 0){
+        (void) rmt_register_tx_end_callback(rmt_tx_end_cb, NULL);
+    }
+
+err_out:
+    return result;
+}
+
+void ws2812_rmt_deinit(ws2812_t *cfg)
+{
+    if(cfg->rmt_channel < RMT_CHANNEL_MAX
+       && rmt_outputs[cfg->rmt_channel] == cfg)
+    {
+        rmt_outputs[cfg->rmt_channel] = NULL;
+        if(--rmt_num_outputs == 0){
+            (void) rmt_register_tx_end_callback(NULL, NULL);
+        }
+    }
+
+    if(cfg->rmt_installed){
+        (void) rmt_driver_uninstall(cfg->rmt_channel);
+        cfg->rmt_installed = false;
+    }
+}
+
+esp_err_t ws2812_rmt_send(tx_buffer_t *buffer)
+{
+    ws2812_t *cfg;
+    esp_err_t result;
+
+    cfg = buffer->cfg;
+
+    /*
+     * Make sure the previous frame is out before marking the new buffer as
+     * busy, otherwise the TX end call-back would hand back the wrong one.
+     */
+    result = rmt_wait_tx_done(cfg->rmt_channel, portMAX_DELAY);
+    if(result != ESP_OK){
+        ESP_LOGE(TAG, "[%s] rmt_wait_tx_done() failed: %s.",
+                __func__, esp_err_to_name(result));
+        (void) xQueueSend(cfg->free_queue, &buffer, 0);
+        goto err_out;
+    }
+
+    cfg->rmt_busy = buffer;
+
+    /* frame length in bits was set up by ws2812_prepare() */
+    result = rmt_write_sample(cfg->rmt_channel, buffer->buff,
+                              buffer->trans.length / 8, false);
+    if(result != ESP_OK){
+        ESP_LOGE(TAG, "[%s] rmt_write_sample() failed: %s.",
+                __func__, esp_err_to_name(result));
+        cfg->rmt_busy = NULL;
+        (void) xQueueSend(cfg->free_queue, &buffer, 0);
+    }
+
+err_out:
+    return result;
+}
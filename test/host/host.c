@@ -0,0 +1,374 @@
+/*
+ * Host implementations of the ESP-IDF and FreeRTOS calls the LED code uses.
+ * Everything runs on one thread: queues fail instead of blocking, the clock
+ * is host_time_us and the periodic timer only fires from host_timer_fire().
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <freertos/FreeRTOS.h>
+#include <esp_err.h>
+#include <esp_system.h>
+#include <esp_cpu.h>
+#include <esp_heap_caps.h>
+#include <esp_partition.h>
+#include <esp_timer.h>
+#include <esp_event.h>
+#include <driver/gpio.h>
+#include <driver/spi_master.h>
+#include "host.h"
+
+int host_verbose;
+int host_failures;
+int64_t host_time_us;
+bool host_bench;
+static const char *host_name;
+
+void host_init(int argc, char **argv)
+{
+    host_name = strrchr(argv[0], '/') ? strrchr(argv[0], '/') + 1 : argv[0];
+    for(int i = 1; i < argc; ++i){
+        if(!strcmp(argv[i], "-b"))
+            host_bench = true;
+        else if(!strcmp(argv[i], "-v"))
+            host_verbose = 1;
+    }
+}
+
+int host_done(void)
+{
+    printf("%s: %s\n", host_name, host_failures ? "FAIL" : "ok");
+    return host_failures ? 1 : 0;
+}
+
+const char *esp_err_to_name(esp_err_t code)
+{
+    static char buf[16];
+
+    snprintf(buf, sizeof(buf), "0x%x", code);
+    return buf;
+}
+
+uint32_t esp_random(void)
+{
+    static uint32_t state = 0x12345678;
+
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+}
+
+uint32_t esp_cpu_get_ccount(void)
+{
+    return (uint32_t) host_ns();
+}
+
+void *heap_caps_malloc(size_t size, unsigned int caps)
+{
+    return malloc(size);
+}
+
+void heap_caps_free(void *ptr)
+{
+    free(ptr);
+}
+
+__attribute__((weak))
+const esp_partition_t *esp_partition_find_first(int type, int subtype,
+                                                const char *label)
+{
+    return NULL;
+}
+
+__attribute__((weak))
+esp_err_t esp_partition_read(const esp_partition_t *part, size_t offset,
+                             void *dst, size_t len)
+{
+    return ESP_ERR_NOT_FOUND;
+}
+
+/* queues */
+struct host_queue {
+    size_t len, item_size, head, count;
+    uint8_t *data;
+};
+
+QueueHandle_t xQueueCreate(UBaseType_t len, UBaseType_t item_size)
+{
+    struct host_queue *queue;
+
+    queue = calloc(1, sizeof(*queue));
+    if(queue == NULL)
+        return NULL;
+
+    queue->len = len;
+    queue->item_size = item_size;
+    queue->data = calloc(len, item_size);
+    if(queue->data == NULL){
+        free(queue);
+        return NULL;
+    }
+
+    return queue;
+}
+
+void vQueueDelete(QueueHandle_t handle)
+{
+    struct host_queue *queue = handle;
+
+    if(queue != NULL){
+        free(queue->data);
+        free(queue);
+    }
+}
+
+BaseType_t xQueueSend(QueueHandle_t handle, const void *item, TickType_t wait)
+{
+    struct host_queue *queue = handle;
+    size_t slot;
+
+    if(queue->count == queue->len)
+        return pdFALSE;
+
+    slot = (queue->head + queue->count) % queue->len;
+    memcpy(queue->data + slot * queue->item_size, item, queue->item_size);
+    ++queue->count;
+
+    return pdTRUE;
+}
+
+BaseType_t xQueueSendFromISR(QueueHandle_t handle, const void *item,
+                             BaseType_t *woken)
+{
+    return xQueueSend(handle, item, 0);
+}
+
+BaseType_t xQueuePeek(QueueHandle_t handle, void *item, TickType_t wait)
+{
+    struct host_queue *queue = handle;
+
+    if(queue->count == 0)
+        return pdFALSE;
+
+    memcpy(item, queue->data + queue->head * queue->item_size,
+           queue->item_size);
+
+    return pdTRUE;
+}
+
+BaseType_t xQueueReceive(QueueHandle_t handle, void *item, TickType_t wait)
+{
+    struct host_queue *queue = handle;
+
+    if(xQueuePeek(handle, item, wait) != pdTRUE)
+        return pdFALSE;
+
+    queue->head = (queue->head + 1) % queue->len;
+    --queue->count;
+
+    return pdTRUE;
+}
+
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t handle)
+{
+    return ((struct host_queue *) handle)->count;
+}
+
+/* with a single thread every take succeeds */
+SemaphoreHandle_t xSemaphoreCreateMutex(void)
+{
+    return malloc(1);
+}
+
+SemaphoreHandle_t xSemaphoreCreateBinary(void)
+{
+    return malloc(1);
+}
+
+BaseType_t xSemaphoreTake(SemaphoreHandle_t sema, TickType_t wait)
+{
+    return pdTRUE;
+}
+
+BaseType_t xSemaphoreGive(SemaphoreHandle_t sema)
+{
+    return pdTRUE;
+}
+
+void vSemaphoreDelete(SemaphoreHandle_t sema)
+{
+    free(sema);
+}
+
+void vEventGroupDelete(EventGroupHandle_t group)
+{
+}
+
+/* task notifications for the one task there is */
+static uint32_t notify_value;
+static bool notify_pending;
+
+void vTaskDelay(TickType_t ticks)
+{
+    host_time_us += (int64_t) ticks * 1000000 / configTICK_RATE_HZ;
+}
+
+TaskHandle_t xTaskGetCurrentTaskHandle(void)
+{
+    return &notify_value;
+}
+
+BaseType_t xTaskNotify(TaskHandle_t task, uint32_t value,
+                       eNotifyAction action)
+{
+    switch(action){
+    case eSetBits:
+        notify_value |= value;
+        break;
+    case eIncrement:
+        ++notify_value;
+        break;
+    case eSetValueWithOverwrite:
+        notify_value = value;
+        break;
+    default:
+        break;
+    }
+    notify_pending = true;
+
+    return pdPASS;
+}
+
+BaseType_t xTaskNotifyWait(uint32_t clear_entry, uint32_t clear_exit,
+                           uint32_t *value, TickType_t wait)
+{
+    if(!notify_pending){
+        if(wait != 0 && wait != portMAX_DELAY)
+            vTaskDelay(wait);
+        return pdFALSE;
+    }
+
+    notify_value &= ~clear_entry;
+    if(value != NULL)
+        *value = notify_value;
+    notify_value &= ~clear_exit;
+    notify_pending = false;
+
+    return pdTRUE;
+}
+
+BaseType_t xTaskNotifyStateClear(TaskHandle_t task)
+{
+    BaseType_t was_pending = notify_pending;
+
+    notify_pending = false;
+    return was_pending;
+}
+
+/* timer: one periodic timer is all the render loop uses */
+struct esp_timer {
+    esp_timer_create_args_t args;
+    uint64_t period;
+    bool running;
+};
+
+int64_t esp_timer_get_time(void)
+{
+    return host_time_us;
+}
+
+esp_err_t esp_timer_create(const esp_timer_create_args_t *args,
+                           esp_timer_handle_t *handle)
+{
+    struct esp_timer *timer;
+
+    timer = calloc(1, sizeof(*timer));
+    if(timer == NULL)
+        return ESP_ERR_NO_MEM;
+
+    timer->args = *args;
+    *handle = timer;
+
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_start_periodic(esp_timer_handle_t timer, uint64_t period)
+{
+    if(timer->running)
+        return ESP_ERR_INVALID_STATE;
+
+    timer->period = period;
+    timer->running = true;
+
+    return ESP_OK;
+}
+
+esp_err_t esp_timer_stop(esp_timer_handle_t timer)
+{
+    if(!timer->running)
+        return ESP_ERR_INVALID_STATE;
+
+    timer->running = false;
+
+    return ESP_OK;
+}
+
+esp_err_t esp_event_loop_create_default(void)
+{
+    return ESP_OK;
+}
+
+/* GPIO and SPI */
+gpio_dev_t GPIO;
+
+esp_err_t gpio_config(const gpio_config_t *cfg)
+{
+    return ESP_OK;
+}
+
+struct spi_device_t {
+    transaction_cb_t post_cb;
+};
+
+void (*host_spi_sink)(const uint8_t *data, size_t len);
+
+esp_err_t spi_bus_initialize(spi_host_device_t host,
+                             const spi_bus_config_t *cfg, int dma_chan)
+{
+    return ESP_OK;
+}
+
+esp_err_t spi_bus_add_device(spi_host_device_t host,
+                             const spi_device_interface_config_t *cfg,
+                             spi_device_handle_t *handle)
+{
+    struct spi_device_t *dev;
+
+    dev = calloc(1, sizeof(*dev));
+    if(dev == NULL)
+        return ESP_ERR_NO_MEM;
+
+    dev->post_cb = cfg->post_cb;
+    *handle = dev;
+
+    return ESP_OK;
+}
+
+esp_err_t spi_bus_remove_device(spi_device_handle_t handle)
+{
+    free(handle);
+    return ESP_OK;
+}
+
+esp_err_t spi_device_queue_trans(spi_device_handle_t handle,
+                                 spi_transaction_t *trans, TickType_t wait)
+{
+    if(host_spi_sink != NULL)
+        host_spi_sink(trans->tx_buffer, trans->length / 8);
+
+    if(handle->post_cb != NULL)
+        handle->post_cb(trans);
+
+    return ESP_OK;
+}
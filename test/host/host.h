@@ -0,0 +1,40 @@
+/*
+ * Helpers shared by the host tests. Each test includes the driver source it
+ * checks, so static functions are reachable directly.
+ */
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+extern int host_failures;
+extern int64_t host_time_us;
+
+/* set when the test binary was started with -b */
+extern bool host_bench;
+
+#define CHECK(cond)                                                     \
+    do {                                                                \
+        if(!(cond)){                                                    \
+            printf("%s:%d: check failed: %s\n", __FILE__, __LINE__,     \
+                   #cond);                                              \
+            ++host_failures;                                            \
+        }                                                               \
+    } while(0)
+
+static inline uint64_t host_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+/* keep the compiler from dropping work whose result is never read */
+#define host_use(x)     __asm__ volatile("" : : "g"(x) : "memory")
+
+void host_init(int argc, char **argv);
+int host_done(void);
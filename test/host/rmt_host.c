@@ -0,0 +1,163 @@
+/*
+ * Host stand-in for the ESP-IDF RMT TX driver. rmt_write_sample() feeds the
+ * sample through the channel's translator in memory block sized pieces, the
+ * way the driver's ISR does, and collects the symbols in host_rmt_items.
+ * Transmission finishes at once, so the TX end call-back runs before
+ * rmt_write_sample() returns.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <driver/rmt.h>
+
+rmt_item32_t *host_rmt_items;
+size_t host_rmt_num_items;
+/* symbols per RMT memory block on the ESP32-C3 */
+size_t host_rmt_block = 48;
+
+static struct {
+    bool configured;
+    bool installed;
+    uint8_t clk_div;
+    sample_to_rmt_t translator;
+    void *context;
+    /* the translator gets a pointer to this, see rmt_translator_get_context */
+    size_t item_num;
+} channels[RMT_CHANNEL_MAX];
+
+static rmt_tx_end_callback_t tx_end;
+
+esp_err_t rmt_config(const rmt_config_t *cfg)
+{
+    if(cfg->channel >= RMT_CHANNEL_MAX)
+        return ESP_ERR_INVALID_ARG;
+
+    channels[cfg->channel].configured = true;
+    channels[cfg->channel].clk_div = cfg->clk_div;
+
+    return ESP_OK;
+}
+
+esp_err_t rmt_driver_install(rmt_channel_t channel, size_t rx_buf_size,
+                             int intr_flags)
+{
+    if(channel >= RMT_CHANNEL_MAX || !channels[channel].configured
+       || channels[channel].installed)
+        return ESP_ERR_INVALID_STATE;
+
+    channels[channel].installed = true;
+
+    return ESP_OK;
+}
+
+esp_err_t rmt_driver_uninstall(rmt_channel_t channel)
+{
+    if(channel >= RMT_CHANNEL_MAX || !channels[channel].installed)
+        return ESP_ERR_INVALID_STATE;
+
+    memset(&channels[channel], 0x0, sizeof(channels[channel]));
+
+    return ESP_OK;
+}
+
+esp_err_t rmt_translator_init(rmt_channel_t channel, sample_to_rmt_t fn)
+{
+    if(channel >= RMT_CHANNEL_MAX || !channels[channel].installed)
+        return ESP_ERR_INVALID_STATE;
+
+    channels[channel].translator = fn;
+
+    return ESP_OK;
+}
+
+esp_err_t rmt_translator_set_context(rmt_channel_t channel, void *context)
+{
+    if(channel >= RMT_CHANNEL_MAX || !channels[channel].installed)
+        return ESP_ERR_INVALID_STATE;
+
+    channels[channel].context = context;
+
+    return ESP_OK;
+}
+
+/* like the driver, find the channel from the item_num pointer */
+esp_err_t rmt_translator_get_context(const size_t *item_num, void **context)
+{
+    unsigned int i;
+
+    for(i = 0; i < RMT_CHANNEL_MAX; ++i){
+        if(item_num == &channels[i].item_num){
+            *context = channels[i].context;
+            return ESP_OK;
+        }
+    }
+
+    return ESP_ERR_INVALID_ARG;
+}
+
+size_t *host_rmt_item_num(rmt_channel_t channel)
+{
+    return &channels[channel].item_num;
+}
+
+esp_err_t rmt_write_sample(rmt_channel_t channel, const uint8_t *src,
+                           size_t src_size, bool wait_tx_done)
+{
+    rmt_item32_t *items;
+    size_t done, used, num;
+
+    if(channel >= RMT_CHANNEL_MAX || channels[channel].translator == NULL)
+        return ESP_ERR_INVALID_STATE;
+
+    /* eight symbols per byte are plenty */
+    items = realloc(host_rmt_items, (src_size * 8 + host_rmt_block)
+                                    * sizeof(*items));
+    if(items == NULL)
+        return ESP_ERR_NO_MEM;
+
+    host_rmt_items = items;
+    host_rmt_num_items = 0;
+
+    for(done = 0; done < src_size; done += used){
+        channels[channel].translator(src + done,
+                                     host_rmt_items + host_rmt_num_items,
+                                     src_size - done, host_rmt_block,
+                                     &used, &channels[channel].item_num);
+        num = channels[channel].item_num;
+        if(used == 0 || num > host_rmt_block)
+            return ESP_FAIL;
+
+        host_rmt_num_items += num;
+    }
+
+    if(tx_end.function != NULL)
+        tx_end.function(channel, tx_end.arg);
+
+    return ESP_OK;
+}
+
+esp_err_t rmt_get_counter_clock(rmt_channel_t channel, uint32_t *clock_hz)
+{
+    if(channel >= RMT_CHANNEL_MAX || !channels[channel].configured)
+        return ESP_ERR_INVALID_STATE;
+
+    *clock_hz = 80000000 / channels[channel].clk_div;
+
+    return ESP_OK;
+}
+
+esp_err_t rmt_wait_tx_done(rmt_channel_t channel, uint32_t wait_time)
+{
+    return ESP_OK;
+}
+
+rmt_tx_end_callback_t rmt_register_tx_end_callback(rmt_tx_end_fn_t function,
+                                                   void *arg)
+{
+    rmt_tx_end_callback_t prev = tx_end;
+
+    tx_end.function = function;
+    tx_end.arg = arg;
+
+    return prev;
+}
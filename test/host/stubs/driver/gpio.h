@@ -0,0 +1,28 @@
+/* Host stand-in for the ESP-IDF header of the same name. */
+#pragma once
+
+#include <stdint.h>
+#include "esp_err.h"
+
+#define GPIO_MODE_OUTPUT        2
+#define GPIO_PULLUP_DISABLE     0
+#define GPIO_PULLDOWN_ENABLE    1
+#define GPIO_INTR_DISABLE       0
+
+typedef struct {
+    uint64_t pin_bit_mask;
+    int mode;
+    int pull_up_en;
+    int pull_down_en;
+    int intr_type;
+} gpio_config_t;
+
+typedef struct {
+    struct {
+        uint32_t inv_sel;
+    } func_out_sel_cfg[64];
+} gpio_dev_t;
+
+extern gpio_dev_t GPIO;
+
+esp_err_t gpio_config(const gpio_config_t *cfg);
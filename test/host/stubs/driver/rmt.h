@@ -0,0 +1,85 @@
+/*
+ * Host stand-in for the ESP-IDF RMT driver. rmt_write_sample() runs the
+ * channel's translator over the whole sample and keeps the symbols, so
+ * tests can look at what would have gone out on the wire.
+ */
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+typedef enum {
+    RMT_CHANNEL_0,
+    RMT_CHANNEL_1,
+    RMT_CHANNEL_2,
+    RMT_CHANNEL_3,
+    RMT_CHANNEL_MAX
+} rmt_channel_t;
+
+typedef struct {
+    union {
+        struct {
+            uint32_t duration0 :15;
+            uint32_t level0 :1;
+            uint32_t duration1 :15;
+            uint32_t level1 :1;
+        };
+        uint32_t val;
+    };
+} rmt_item32_t;
+
+typedef struct {
+    bool carrier_en;
+    bool loop_en;
+    bool idle_output_en;
+    int idle_level;
+} rmt_tx_config_t;
+
+typedef struct {
+    int rmt_mode;
+    rmt_channel_t channel;
+    int gpio_num;
+    uint8_t clk_div;
+    uint8_t mem_block_num;
+    uint32_t flags;
+    rmt_tx_config_t tx_config;
+} rmt_config_t;
+
+#define RMT_DEFAULT_CONFIG_TX(gpio, ch) \
+    { .rmt_mode = 0, .channel = ch, .gpio_num = gpio, .clk_div = 80, \
+      .mem_block_num = 1 }
+#define RMT_IDLE_LEVEL_LOW  0
+
+typedef void (*sample_to_rmt_t)(const void *src, rmt_item32_t *dest,
+                                size_t src_size, size_t wanted_num,
+                                size_t *translated_size, size_t *item_num);
+typedef void (*rmt_tx_end_fn_t)(rmt_channel_t channel, void *arg);
+
+typedef struct {
+    rmt_tx_end_fn_t function;
+    void *arg;
+} rmt_tx_end_callback_t;
+
+esp_err_t rmt_config(const rmt_config_t *cfg);
+esp_err_t rmt_driver_install(rmt_channel_t channel, size_t rx_buf_size,
+                             int intr_flags);
+esp_err_t rmt_driver_uninstall(rmt_channel_t channel);
+esp_err_t rmt_translator_init(rmt_channel_t channel, sample_to_rmt_t fn);
+esp_err_t rmt_translator_set_context(rmt_channel_t channel, void *context);
+esp_err_t rmt_translator_get_context(const size_t *item_num, void **context);
+esp_err_t rmt_write_sample(rmt_channel_t channel, const uint8_t *src,
+                           size_t src_size, bool wait_tx_done);
+esp_err_t rmt_get_counter_clock(rmt_channel_t channel, uint32_t *clock_hz);
+esp_err_t rmt_wait_tx_done(rmt_channel_t channel, uint32_t wait_time);
+rmt_tx_end_callback_t rmt_register_tx_end_callback(rmt_tx_end_fn_t function,
+                                                   void *arg);
+
+/* symbols produced by the last rmt_write_sample() */
+extern rmt_item32_t *host_rmt_items;
+extern size_t host_rmt_num_items;
+/* RMT memory block size the translator gets called with */
+extern size_t host_rmt_block;
+/* the item_num pointer the stand-in passes to the channel's translator */
+size_t *host_rmt_item_num(rmt_channel_t channel);
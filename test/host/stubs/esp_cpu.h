@@ -0,0 +1,6 @@
+/* Host stand-in for the ESP-IDF header of the same name. */
+#pragma once
+
+#include <stdint.h>
+
+uint32_t esp_cpu_get_ccount(void);
@@ -0,0 +1,6 @@
+/* Host stand-in for the ESP-IDF header of the same name. */
+#pragma once
+
+#include "esp_err.h"
+
+esp_err_t esp_event_loop_create_default(void);
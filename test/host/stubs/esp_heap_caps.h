@@ -0,0 +1,11 @@
+/* Host stand-in for the ESP-IDF header of the same name. */
+#pragma once
+
+#include <stddef.h>
+
+#define MALLOC_CAP_32BIT    (1 << 1)
+#define MALLOC_CAP_8BIT     (1 << 2)
+#define MALLOC_CAP_DMA      (1 << 3)
+
+void *heap_caps_malloc(size_t size, unsigned int caps);
+void heap_caps_free(void *ptr);
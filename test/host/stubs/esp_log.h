@@ -0,0 +1,17 @@
+/* Host stand-in for the ESP-IDF header of the same name. */
+#pragma once
+
+#include <stdio.h>
+#include "esp_err.h"
+
+/* quiet by default, set host_verbose to see the driver's messages */
+extern int host_verbose;
+
+#define HOST_LOG(tag, fmt, ...) \
+    do { if(host_verbose) printf("%s: " fmt "\n", tag, ##__VA_ARGS__); } while(0)
+
+#define ESP_LOGE    HOST_LOG
+#define ESP_LOGW    HOST_LOG
+#define ESP_LOGI    HOST_LOG
+#define ESP_LOGD    HOST_LOG
+#define ESP_LOGV    HOST_LOG
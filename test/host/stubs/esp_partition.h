@@ -0,0 +1,16 @@
+/* Host stand-in for the ESP-IDF header of the same name. */
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include "esp_err.h"
+
+typedef struct {
+    uint32_t size;
+} esp_partition_t;
+
+/* tests provide these when they need flash contents */
+const esp_partition_t *esp_partition_find_first(int type, int subtype,
+                                                const char *label);
+esp_err_t esp_partition_read(const esp_partition_t *part, size_t offset,
+                             void *dst, size_t len);
@@ -0,0 +1,7 @@
+/* Host stand-in for the ESP-IDF header of the same name. */
+#pragma once
+
+#include <stdint.h>
+#include "esp_err.h"
+
+uint32_t esp_random(void);
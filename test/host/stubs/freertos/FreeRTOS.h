@@ -0,0 +1,62 @@
+/*
+ * Host stand-in for FreeRTOS. There is only one task, so queues never block:
+ * a call that would have to wait fails right away instead.
+ */
+#pragma once
+
+#include <stdatomic.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include "sdkconfig.h"
+
+typedef int BaseType_t;
+typedef unsigned int UBaseType_t;
+typedef uint32_t TickType_t;
+
+#define pdTRUE                  1
+#define pdFALSE                 0
+#define pdPASS                  pdTRUE
+#define portMAX_DELAY           0xffffffffu
+#define configTICK_RATE_HZ      100
+#define portTICK_PERIOD_MS      (1000 / configTICK_RATE_HZ)
+#define pdMS_TO_TICKS(ms)       ((ms) / portTICK_PERIOD_MS)
+#define configASSERT(x)         do { if(!(x)) __builtin_trap(); } while(0)
+#define IRAM_ATTR
+
+typedef void *QueueHandle_t;
+typedef void *SemaphoreHandle_t;
+typedef void *TaskHandle_t;
+typedef void *EventGroupHandle_t;
+
+typedef enum {
+    eNoAction,
+    eSetBits,
+    eIncrement,
+    eSetValueWithOverwrite
+} eNotifyAction;
+
+QueueHandle_t xQueueCreate(UBaseType_t len, UBaseType_t item_size);
+void vQueueDelete(QueueHandle_t queue);
+BaseType_t xQueueSend(QueueHandle_t queue, const void *item, TickType_t wait);
+#define xQueueSendToBack(queue, item, wait) xQueueSend(queue, item, wait)
+BaseType_t xQueueSendFromISR(QueueHandle_t queue, const void *item,
+                             BaseType_t *woken);
+BaseType_t xQueueReceive(QueueHandle_t queue, void *item, TickType_t wait);
+BaseType_t xQueuePeek(QueueHandle_t queue, void *item, TickType_t wait);
+UBaseType_t uxQueueMessagesWaiting(QueueHandle_t queue);
+
+SemaphoreHandle_t xSemaphoreCreateMutex(void);
+SemaphoreHandle_t xSemaphoreCreateBinary(void);
+BaseType_t xSemaphoreTake(SemaphoreHandle_t sema, TickType_t wait);
+BaseType_t xSemaphoreGive(SemaphoreHandle_t sema);
+void vSemaphoreDelete(SemaphoreHandle_t sema);
+void vEventGroupDelete(EventGroupHandle_t group);
+
+void vTaskDelay(TickType_t ticks);
+TaskHandle_t xTaskGetCurrentTaskHandle(void);
+BaseType_t xTaskNotify(TaskHandle_t task, uint32_t value,
+                       eNotifyAction action);
+BaseType_t xTaskNotifyWait(uint32_t clear_entry, uint32_t clear_exit,
+                           uint32_t *value, TickType_t wait);
+BaseType_t xTaskNotifyStateClear(TaskHandle_t task);
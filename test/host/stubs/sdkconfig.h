@@ -0,0 +1,48 @@
+/*
+ * Host build configuration. Tests enable the boolean options they exercise
+ * with #define before including the unit under test; only the numeric
+ * options get defaults here.
+ */
+#pragma once
+
+#ifndef CONFIG_WS2812_MAX_LEDS
+#define CONFIG_WS2812_MAX_LEDS          1024
+#endif
+
+#ifndef CONFIG_WS2812_DATA_PIN
+#define CONFIG_WS2812_DATA_PIN          10
+#endif
+
+#ifndef CONFIG_WS2812_CLOCK_PIN
+#define CONFIG_WS2812_CLOCK_PIN         9
+#endif
+
+#ifndef CONFIG_APA102_CLOCK_FREQ
+#define CONFIG_APA102_CLOCK_FREQ        10000000
+#endif
+
+#ifndef CONFIG_WS2812_RMT_CHANNEL
+#define CONFIG_WS2812_RMT_CHANNEL       1
+#endif
+
+#ifndef CONFIG_WS2812_STREAM_CHUNK
+#define CONFIG_WS2812_STREAM_CHUNK      64
+#endif
+
+#ifndef CONFIG_WS2812_POWER_BUDGET_MA
+#define CONFIG_WS2812_POWER_BUDGET_MA   500
+#define CONFIG_WS2812_POWER_RED_MA      12
+#define CONFIG_WS2812_POWER_GREEN_MA    12
+#define CONFIG_WS2812_POWER_BLUE_MA     12
+#define CONFIG_WS2812_POWER_WHITE_MA    20
+#define CONFIG_WS2812_POWER_IDLE_UA     1000
+#endif
+
+#ifndef CONFIG_BLINKEN_KEEPALIVE_MS
+#define CONFIG_BLINKEN_KEEPALIVE_MS     1000
+#endif
+
+#if !defined(CONFIG_BLINKEN_TYPE_RGB) && !defined(CONFIG_BLINKEN_TYPE_RGBW) \
+    && !defined(CONFIG_BLINKEN_TYPE_APA102)
+#define CONFIG_BLINKEN_TYPE_GRB         1
+#endif
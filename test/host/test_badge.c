@@ -0,0 +1,247 @@
+/*
+ * Layer compositing of the badge filters: with a single opaque layer the
+ * root filter must hand out exactly what it did before there were layers,
+ * overlays may only change the pixels they touch, layers under an opaque
+ * one must not even be converted, and the blend kernels must round to
+ * nearest without drifting either way.
+ */
+
+#include <math.h>
+#include <esp_system.h>
+#include <esp_timer.h>
+#include "hipbadge.c"
+#include "host.h"
+
+#define RUN_FRAMES      3000
+#define FRAME_US        (1000000 / REFRESH)
+
+void init_ble(void)
+{
+}
+
+QueueHandle_t blinken_ctrl_get_queue(void)
+{
+    return NULL;
+}
+
+esp_err_t blinken_ctrl_start(void)
+{
+    return ESP_OK;
+}
+
+static struct led_filter *root;
+static void *state;
+static hsv_value_t out[FBUFFER_LEN];
+
+/* the root filter as it was: copy the frame buffer and scale its value */
+static void old_root(hsv_value_t *dst, const hsv_value_t *fb,
+                     unsigned int brightness)
+{
+    unsigned int idx, scale;
+
+    scale = HSV_VAL_MAX / (BRIGHTNESS_STEPS - 1) * brightness;
+    for(idx = 0; idx < FBUFFER_LEN; ++idx){
+        dst[idx] = fb[idx];
+        dst[idx].value = (fb[idx].value * scale) / HSV_VAL_MAX;
+    }
+}
+
+static void render(void)
+{
+    host_time_us += FRAME_US;
+    filter_reset_wake(root);
+    root->filter(root, state, out, FBUFFER_LEN, 0, host_time_us);
+}
+
+static void send_event(enum ctrl_event_type type)
+{
+    struct ctrl_event evt = { .event = type };
+
+    CHECK(root->event(root, state, &evt) == 1);
+}
+
+static void check_single(void)
+{
+    struct ctx_root *ctx_root = f_root.priv;
+    struct ctx_ir *ctx_ir = f_ir.priv;
+    hsv_value_t ref[FBUFFER_LEN];
+    unsigned int frame;
+
+    /* end the IR flash shown at start-up */
+    ctx_ir->base.ticks = 3 * FBUFFER_LEN + 20;
+    send_event(EVNT_AIR_GOOD);
+
+    for(frame = 0; frame < RUN_FRAMES; ++frame){
+        ctx_root->brightness = (frame / 100) % BRIGHTNESS_STEPS;
+        render();
+
+        CHECK(!layers[layer_ir].enabled && !layers[layer_air].enabled);
+        old_root(ref, layers[layer_badge].pixels, ctx_root->brightness);
+        CHECK(memcmp(out, ref, sizeof(out)) == 0);
+    }
+}
+
+static void check_overlay(void)
+{
+    struct ctx_root *ctx_root = f_root.priv;
+    struct ctx_ir *ctx_ir = f_ir.priv;
+    rgb_value_t badge_rgb[FBUFFER_LEN], ir_rgb[FBUFFER_LEN];
+    rgb_value_t got, want;
+    hsv_value_t ref[FBUFFER_LEN], *ir;
+    unsigned int frame, idx;
+
+    ctx_root->brightness = BRIGHTNESS_STEPS - 1;
+
+    /* hold the IR animation, the test draws every other pixel itself */
+    ctx_ir->base.ticks = 0;
+    ctx_ir->base.wait = UINT64_MAX;
+    ir = layers[layer_ir].pixels;
+
+    for(frame = 0; frame < RUN_FRAMES; ++frame){
+        for(idx = 0; idx < FBUFFER_LEN; ++idx){
+            memset(&ir[idx], 0x0, sizeof(ir[idx]));
+            if(idx % 2){
+                ir[idx].hue = esp_random() % HSV_HUE_STEPS;
+                ir[idx].saturation = esp_random() % 0x10000;
+                ir[idx].value = esp_random() % (HSV_VAL_MAX + 1);
+            }
+        }
+
+        render();
+        CHECK(layers[layer_ir].enabled);
+
+        old_root(ref, layers[layer_badge].pixels, ctx_root->brightness);
+        hsv2rgb_batch(layers[layer_badge].pixels, badge_rgb, FBUFFER_LEN,
+                      pixel_rgb);
+        hsv2rgb_batch(ir, ir_rgb, FBUFFER_LEN, pixel_rgb);
+
+        for(idx = 0; idx < FBUFFER_LEN; ++idx){
+            if((ir_rgb[idx].red | ir_rgb[idx].green | ir_rgb[idx].blue) == 0){
+                CHECK(memcmp(&out[idx], &ref[idx], sizeof(out[idx])) == 0);
+                continue;
+            }
+
+            /* the sum, give or take the HSV round trip and the dimming */
+            want.red = min(badge_rgb[idx].red + ir_rgb[idx].red, 0xff);
+            want.green = min(badge_rgb[idx].green + ir_rgb[idx].green, 0xff);
+            want.blue = min(badge_rgb[idx].blue + ir_rgb[idx].blue, 0xff);
+            hsv2rgb_batch(&out[idx], &got, 1, pixel_rgb);
+
+            CHECK(abs(got.red - want.red) <= 2);
+            CHECK(abs(got.green - want.green) <= 2);
+            CHECK(abs(got.blue - want.blue) <= 2);
+        }
+    }
+
+    ctx_ir->base.wait = 0;
+}
+
+/* bad air covers everything, nothing below it is converted */
+static void check_covered(void)
+{
+    struct ctx_root *ctx_root = f_root.priv;
+    hsv_value_t ref[FBUFFER_LEN];
+    unsigned int frame;
+
+    send_event(EVNT_AIR_BAD);
+    send_event(EVNT_OK);
+
+    /* the IR flash runs for 3 * FBUFFER_LEN + 20 frames */
+    for(frame = 0; frame < 3 * FBUFFER_LEN + 20; ++frame){
+        memset(layer_rgb, 0xaa, sizeof(layer_rgb));
+        memset(comp_rgb, 0xaa, sizeof(comp_rgb));
+
+        render();
+        CHECK(layers[layer_air].enabled);
+        CHECK(layers[layer_ir].enabled);
+
+        old_root(ref, layers[layer_air].pixels, ctx_root->brightness);
+        CHECK(memcmp(out, ref, sizeof(out)) == 0);
+
+        CHECK(layer_rgb[0].red == 0xaa && comp_rgb[0].red == 0xaa);
+    }
+
+    send_event(EVNT_AIR_GOOD);
+}
+
+/* every pair of bytes at every opacity against the exact blend */
+static void check_rounding(enum blend_mode mode)
+{
+    unsigned int opacity, dst, src;
+    double exact, err, worst, bias;
+    uint8_t byte, from, mirror;
+
+    worst = bias = 0;
+    for(opacity = 0; opacity <= LAYER_OPAQUE; ++opacity){
+        for(dst = 0; dst < 256; ++dst){
+            for(src = 0; src < 256; ++src){
+                byte = dst;
+                from = src;
+                blend_layer(&byte, &from, 1, mode, opacity);
+
+                switch(mode){
+                case blend_add:
+                    exact = min(dst + src * opacity / 256.0, 255.0);
+                    break;
+                case blend_multiply:
+                    exact = mul8(dst, src);
+                    exact = dst + (exact - dst) * opacity / 256.0;
+                    break;
+                case blend_max:
+                    exact = dst + (max(dst, src) - dst) * opacity / 256.0;
+                    break;
+                default:
+                    exact = dst + ((double) src - dst) * opacity / 256.0;
+                    break;
+                }
+
+                /* fading to black mirrors fading to white */
+                if(mode == blend_alpha){
+                    mirror = 255 - dst;
+                    from = 255 - src;
+                    blend_layer(&mirror, &from, 1, mode, opacity);
+                    CHECK(mirror == 255 - byte);
+                }
+
+                err = byte - exact;
+                worst = fmax(worst, fabs(err));
+                bias += err;
+            }
+        }
+    }
+
+    bias /= (LAYER_OPAQUE + 1) * 256.0 * 256.0;
+    CHECK(worst <= 0.5);
+    CHECK(fabs(bias) < 0.01);
+
+    if(host_bench)
+        printf("blend mode %d: worst %.3f, mean error %+.4f\n", mode,
+               worst, bias);
+}
+
+int main(int argc, char **argv)
+{
+    struct blinken_cfg cfg = {
+        .strip_len = FBUFFER_LEN,
+        .refresh = REFRESH,
+        .brightness = HSV_VAL_MAX,
+    };
+
+    host_init(argc, argv);
+
+    check_rounding(blend_alpha);
+    check_rounding(blend_add);
+    check_rounding(blend_multiply);
+    check_rounding(blend_max);
+
+    CHECK(create_filters(&cfg, &root, &state) == ESP_OK);
+    if(host_failures)
+        return host_done();
+
+    check_single();
+    check_overlay();
+    check_covered();
+    check_single();
+
+    return host_done();
+}
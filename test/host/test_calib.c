@@ -0,0 +1,204 @@
+/*
+ * Load an image made by gen_calib.py from calib_gains.txt and check that the
+ * encoded colours are the input scaled by the gains in that list.
+ */
+
+#include <math.h>
+#include "ws2812.c"
+#include "host.h"
+
+#define TEST_LEDS       24
+#define FIRST_LED       5       // this output starts at LED 5 of the list
+#define MAX_GAINS       64
+
+static uint8_t image[4096];
+static esp_partition_t part = { .size = sizeof(image) };
+static bool have_part;
+
+const esp_partition_t *esp_partition_find_first(int type, int subtype,
+                                                const char *label)
+{
+    if(!have_part || type != CALIB_PART_TYPE || subtype != CALIB_PART_SUBTYPE
+       || strcmp(label, "ledcal"))
+        return NULL;
+
+    return &part;
+}
+
+esp_err_t esp_partition_read(const esp_partition_t *p, size_t offset,
+                             void *dst, size_t len)
+{
+    if(offset + len > p->size)
+        return ESP_ERR_INVALID_SIZE;
+
+    memcpy(dst, &image[offset], len);
+    return ESP_OK;
+}
+
+/* the gains as floats, straight from the list */
+static float gains[MAX_GAINS][4];
+static size_t num_gains;
+
+static void read_gains(const char *path)
+{
+    char line[128], *p;
+    FILE *f;
+    int n;
+
+    f = fopen(path, "r");
+    CHECK(f != NULL);
+    if(f == NULL)
+        return;
+
+    while(fgets(line, sizeof(line), f) != NULL && num_gains < MAX_GAINS){
+        if((p = strchr(line, '#')) != NULL)
+            *p = '\0';
+        for(p = line; *p; ++p)
+            if(*p == ',')
+                *p = ' ';
+
+        gains[num_gains][3] = 1.0f;
+        n = sscanf(line, "%f %f %f %f", &gains[num_gains][0],
+                   &gains[num_gains][1], &gains[num_gains][2],
+                   &gains[num_gains][3]);
+        if(n >= 3)
+            ++num_gains;
+    }
+    fclose(f);
+}
+
+static void read_image(const char *path)
+{
+    FILE *f;
+
+    f = fopen(path, "rb");
+    CHECK(f != NULL);
+    if(f == NULL)
+        return;
+
+    CHECK(fread(image, 1, sizeof(image), f) > sizeof(struct calib_header));
+    fclose(f);
+    have_part = true;
+}
+
+static struct {
+    uint8_t data[TEST_LEDS * 4];
+    size_t len;
+} captured;
+
+static void sink(ws2812_t *cfg, const uint8_t *data, size_t len, void *priv)
+{
+    memcpy(captured.data, data, min(len, sizeof(captured.data)));
+    captured.len = len;
+}
+
+static void send(ws2812_t *cfg, rgb_value_t *rgb)
+{
+    tx_buffer_t *buffer = NULL;
+
+    CHECK(ws2812_prepare_rgb(cfg, rgb, TEST_LEDS, &buffer) == ESP_OK);
+    if(buffer != NULL)
+        CHECK(ws2812_send(buffer) == ESP_OK);
+    CHECK(captured.len == TEST_LEDS * 4);
+}
+
+static void check_gains(ws2812_t *cfg, const uint8_t *gamma)
+{
+    static rgb_value_t rgb[TEST_LEDS];
+    const float *gain;
+    unsigned int round, chan;
+    uint8_t in[4], out, lin;
+    double want;
+    size_t i;
+
+    CHECK(ws2812_set_correction(cfg, gamma, NULL, HSV_VAL_MAX) == ESP_OK);
+
+    for(round = 0; round < 64; ++round){
+        for(i = 0; i < TEST_LEDS; ++i){
+            rgb[i].red = round * 4 + 3;
+            rgb[i].green = 255 - round;
+            rgb[i].blue = (i * 37 + round * 11) & 0xff;
+            rgb[i].white = i * 10;
+        }
+        send(cfg, rgb);
+
+        for(i = 0; i < TEST_LEDS; ++i){
+            gain = gains[FIRST_LED + i];
+            memcpy(in, &rgb[i], sizeof(in));
+            for(chan = 0; chan < 4; ++chan){
+                /* gains apply to the light output, after gamma */
+                lin = (gamma != NULL) ? gamma[in[chan]] : in[chan];
+                out = captured.data[i * 4 + chan];
+                want = lin * gain[chan];
+
+                /* gains are stored in 1/256 steps and the result floors */
+                CHECK(fabs(out - want) < 1.5);
+                CHECK(out <= lin);
+            }
+        }
+    }
+}
+
+int main(int argc, char **argv)
+{
+    static uint8_t gamma[256];
+    static rgb_value_t rgb[TEST_LEDS];
+    ws2812_output_t output = {
+        .backend = ws2812_sink,
+        .type = pixel_rgbw,
+        .max_len = TEST_LEDS,
+        .sink = sink,
+    };
+    struct calib_header *hdr;
+    ws2812_t *cfg;
+    unsigned int i;
+
+    host_init(argc, argv);
+
+    read_gains(TEST_GAINS);
+    read_image(TEST_IMAGE);
+    CHECK(num_gains >= FIRST_LED + TEST_LEDS);
+    if(host_failures)
+        return host_done();
+
+    for(i = 0; i < 256; ++i)
+        gamma[i] = lrint(255 * pow(i / 255.0, 2.3));
+
+    cfg = ws2812_init_output(&output);
+    CHECK(cfg != NULL);
+    if(cfg == NULL)
+        return host_done();
+
+    /* no gain table until calibration is loaded */
+    CHECK(cfg->calib == NULL);
+    CHECK(ws2812_load_calibration(cfg, "ledcal", FIRST_LED) == ESP_OK);
+    CHECK(cfg->calib != NULL);
+    check_gains(cfg, NULL);
+    check_gains(cfg, gamma);
+
+    /* without calibration the colours pass unchanged */
+    memset(rgb, 0xa5, sizeof(rgb));
+    CHECK(ws2812_set_calibration(cfg, NULL, 0) == ESP_OK);
+    CHECK(cfg->calib == NULL);
+    CHECK(ws2812_set_correction(cfg, NULL, NULL, HSV_VAL_MAX) == ESP_OK);
+    send(cfg, rgb);
+    for(i = 0; i < TEST_LEDS * 4; ++i)
+        CHECK(captured.data[i] == 0xa5);
+
+    /* a blank partition is not an error for the LEDs, they stay as is */
+    hdr = (struct calib_header *) image;
+    hdr->magic = ~CALIB_MAGIC;
+    CHECK(ws2812_load_calibration(cfg, "ledcal", FIRST_LED)
+          == ESP_ERR_NOT_FOUND);
+    send(cfg, rgb);
+    CHECK(captured.data[0] == 0xa5);
+
+    /* records beyond the partition are refused */
+    hdr->magic = CALIB_MAGIC;
+    hdr->count = sizeof(image);
+    CHECK(ws2812_load_calibration(cfg, "ledcal", 0) == ESP_ERR_INVALID_SIZE);
+
+    CHECK(ws2812_load_calibration(cfg, "other", 0) == ESP_ERR_NOT_FOUND);
+
+    return host_done();
+}
@@ -0,0 +1,172 @@
+/*
+ * Frames prepared with CONFIG_WS2812_DIRTY_TRACKING must match a full encode
+ * byte for byte. Built with and without the option, -b times ws2812_prepare()
+ * for a few strip lengths and shares of changed pixels, for comparing the two.
+ */
+
+#include "ws2812.c"
+#include "host.h"
+
+#define MAX_TEST_LEDS   1024
+#define BENCH_ROUNDS    200
+#define BENCH_REPEAT    10
+
+static uint8_t sent[MAX_TEST_LEDS * 4 * 4 + 256];
+static size_t sent_len;
+
+static void capture(const uint8_t *data, size_t len)
+{
+    memcpy(sent, data, min(len, sizeof(sent)));
+    sent_len = len;
+}
+
+/* change every step-th pixel, step 0 changes none */
+static void next_frame(hsv_value_t *hsv, rgb_value_t *rgb, size_t len,
+                       size_t step, unsigned int frame)
+{
+    size_t i;
+
+    if(step == 0)
+        return;
+
+    for(i = frame % step; i < len; i += step){
+        hsv[i].hue = (hsv[i].hue + 97) % HSV_HUE_STEPS;
+        hsv[i].saturation = HSV_SAT_MAX - (i & 0xff);
+        hsv[i].value = SCALE_UP((i + frame) & 0xff);
+        rgb[i].red += 3;
+        rgb[i].green ^= frame;
+        rgb[i].blue = i + frame;
+    }
+}
+
+static size_t full_encode(ws2812_t *cfg, uint8_t *dst, const hsv_value_t *hsv,
+                          const rgb_value_t *rgb, size_t len)
+{
+    uint8_t *bufp;
+
+    bufp = encode_start(cfg, dst);
+    cfg->enc_pos = 0;
+    bufp = (rgb != NULL) ? cfg->encode_rgb(cfg, bufp, rgb, len)
+                         : cfg->encode(cfg, bufp, hsv, len);
+    bufp = encode_reset(cfg, bufp);
+
+    return bufp - dst;
+}
+
+static void check_frames(ws2812_t *cfg, hsv_value_t *hsv, rgb_value_t *rgb,
+                         size_t len)
+{
+    static uint8_t ref[sizeof(sent)];
+    tx_buffer_t *buffer;
+    unsigned int frame;
+    size_t ref_len;
+    bool use_rgb;
+
+    CHECK(ws2812_set_len(cfg, len) == ESP_OK);
+
+    /* mix in switches between HSV and RGB frames */
+    for(frame = 0; frame < 40; ++frame){
+        use_rgb = (frame / 7) & 1;
+        next_frame(hsv, rgb, len, 1 + frame % 5, frame);
+
+        buffer = NULL;
+        if(use_rgb)
+            CHECK(ws2812_prepare_rgb(cfg, rgb, len, &buffer) == ESP_OK);
+        else
+            CHECK(ws2812_prepare(cfg, hsv, len, &buffer) == ESP_OK);
+        if(buffer == NULL)
+            return;
+
+        sent_len = 0;
+        CHECK(ws2812_send(buffer) == ESP_OK);
+
+        ref_len = full_encode(cfg, ref, hsv, use_rgb ? rgb : NULL, len);
+        CHECK(sent_len == ref_len);
+        CHECK(memcmp(sent, ref, ref_len) == 0);
+    }
+}
+
+static void bench(ws2812_t *cfg, hsv_value_t *hsv, rgb_value_t *rgb,
+                  size_t len)
+{
+    static const size_t steps[] = { 0, 10, 1 };
+    static const char *const changed[] = { "none", "10%", "all" };
+    tx_buffer_t *buffer;
+    unsigned int round, rep, idx, use_rgb;
+    uint64_t start, ns, best;
+
+    (void) ws2812_set_len(cfg, len);
+
+    for(use_rgb = 0; use_rgb < 2; ++use_rgb){
+        for(idx = 0; idx < ARRAY_SIZE(steps); ++idx){
+            /* best of a few runs, to keep the noise down */
+            best = UINT64_MAX;
+            for(rep = 0; rep < BENCH_REPEAT; ++rep){
+                ns = 0;
+                for(round = 0; round < BENCH_ROUNDS; ++round){
+                    next_frame(hsv, rgb, len, steps[idx], round);
+
+                    start = host_ns();
+                    if(use_rgb)
+                        (void) ws2812_prepare_rgb(cfg, rgb, len, &buffer);
+                    else
+                        (void) ws2812_prepare(cfg, hsv, len, &buffer);
+                    ns += host_ns() - start;
+
+                    (void) ws2812_send(buffer);
+                }
+                best = min(best, ns);
+            }
+
+            printf("prepare %s %4zu LEDs, %-4s changed: %8.2f us/frame\n",
+                   use_rgb ? "rgb" : "hsv", len, changed[idx],
+                   (double) best / BENCH_ROUNDS / 1000);
+        }
+    }
+}
+
+int main(int argc, char **argv)
+{
+    static const size_t lens[] = { 16, 256, 1024 };
+    static hsv_value_t hsv[MAX_TEST_LEDS];
+    static rgb_value_t rgb[MAX_TEST_LEDS];
+    ws2812_t *cfg;
+    unsigned int idx;
+
+    host_init(argc, argv);
+
+    cfg = ws2812_init(MAX_TEST_LEDS, pixel_grb);
+    CHECK(cfg != NULL);
+    if(cfg == NULL)
+        return host_done();
+
+    /* an 8 bit gamma table, so the LUT is not the identity */
+    {
+        static uint8_t gamma[256];
+        unsigned int i;
+
+        for(i = 0; i < 256; ++i)
+            gamma[i] = (i * i) / 255;
+        CHECK(ws2812_set_correction(cfg, gamma, NULL, HSV_VAL_MAX / 2)
+              == ESP_OK);
+    }
+
+    host_spi_sink = capture;
+    for(idx = 0; idx < ARRAY_SIZE(lens); ++idx)
+        check_frames(cfg, hsv, rgb, lens[idx]);
+    host_spi_sink = NULL;
+
+    if(host_bench){
+        printf("dirty tracking %s\n",
+#if defined(CONFIG_WS2812_DIRTY_TRACKING)
+               "on"
+#else
+               "off"
+#endif
+              );
+        for(idx = 0; idx < ARRAY_SIZE(lens); ++idx)
+            bench(cfg, hsv, rgb, lens[idx]);
+    }
+
+    return host_done();
+}
@@ -0,0 +1,169 @@
+/*
+ * Check the table driven SPI encoder against the bit loop it replaced, for
+ * every colour byte and for whole pixels. With -b it also times both.
+ */
+
+#include "ws2812.c"
+#include "host.h"
+
+#if defined(CONFIG_WS2812_ENCODING_3BIT)
+/* three SPI bits per WS2812 bit, shifted out MSB first */
+static uint8_t *ref_encode(uint8_t *dst, uint8_t colour)
+{
+    uint32_t stream = 0;
+    int bit;
+
+    for(bit = 7; bit >= 0; --bit){
+        stream <<= 3;
+        stream |= (colour & (1 << bit)) ? WS_BIT_1 : WS_BIT_0;
+    }
+
+    *dst++ = (stream >> 16) ^ WS_BITS_INVERT;
+    *dst++ = (stream >> 8) ^ WS_BITS_INVERT;
+    *dst++ = stream ^ WS_BITS_INVERT;
+
+    return dst;
+}
+#else
+/* rgb2pwm() as it was before the look-up table, plus the inversion */
+static uint8_t *ref_encode(uint8_t *dst, uint8_t colour)
+{
+    unsigned int cnt;
+    uint32_t data = colour;
+
+    for(cnt = 0; cnt < 4; ++cnt){
+        switch (data & 0xC0) {
+        case 0x00:
+            *dst = WS_BITS_00;
+            break;
+        case 0x40:
+            *dst = WS_BITS_01;
+            break;
+        case 0x80:
+            *dst = WS_BITS_10;
+            break;
+        case 0xC0:
+            *dst = WS_BITS_11;
+            break;
+        }
+        *dst ^= WS_BITS_INVERT;
+
+        dst++;
+        data <<= 2;
+    }
+
+    return dst;
+}
+#endif
+
+#define BENCH_LEDS      1024
+#define BENCH_ROUNDS    200
+
+static uint32_t lut_buf[BENCH_LEDS * 4];
+static uint8_t ref_buf[BENCH_LEDS * 4 * sizeof(uint32_t)];
+
+static void check_bytes(void)
+{
+    unsigned int i;
+    uint8_t *end;
+
+    for(i = 0; i < 256; ++i){
+        memset(lut_buf, 0x55, sizeof(lut_buf));
+        end = put_colour((uint8_t *) lut_buf, i);
+        CHECK(end - (uint8_t *) lut_buf == WS2812_SPI_BITS);
+        ref_encode(ref_buf, i);
+        CHECK(memcmp(lut_buf, ref_buf, end - (uint8_t *) lut_buf) == 0);
+    }
+}
+
+/* whole GRB pixels through the specialised encoder, no correction */
+static void check_pixels(ws2812_t *cfg, const rgb_value_t *rgb, size_t len)
+{
+    uint8_t *end, *ref;
+    size_t i;
+
+    end = cfg->encode_rgb(cfg, (uint8_t *) lut_buf, rgb, len);
+    CHECK((size_t) (end - (uint8_t *) lut_buf) == ws2812_data_len(pixel_grb,
+                                                                  len));
+
+    ref = ref_buf;
+    for(i = 0; i < len; ++i){
+        ref = ref_encode(ref, rgb[i].green);
+        ref = ref_encode(ref, rgb[i].red);
+        ref = ref_encode(ref, rgb[i].blue);
+    }
+    CHECK(memcmp(lut_buf, ref_buf, ref - ref_buf) == 0);
+}
+
+static void bench(ws2812_t *cfg, const rgb_value_t *rgb, size_t len)
+{
+    uint64_t start, ref_ns, lut_ns, enc_ns;
+    unsigned int round;
+    uint8_t *ref;
+    size_t i;
+
+    start = host_ns();
+    for(round = 0; round < BENCH_ROUNDS; ++round){
+        ref = ref_buf;
+        for(i = 0; i < len; ++i){
+            ref = ref_encode(ref, rgb[i].green);
+            ref = ref_encode(ref, rgb[i].red);
+            ref = ref_encode(ref, rgb[i].blue);
+        }
+        host_use(ref_buf);
+    }
+    ref_ns = host_ns() - start;
+
+    start = host_ns();
+    for(round = 0; round < BENCH_ROUNDS; ++round){
+        ref = (uint8_t *) lut_buf;
+        for(i = 0; i < len; ++i){
+            ref = put_colour(ref, rgb[i].green);
+            ref = put_colour(ref, rgb[i].red);
+            ref = put_colour(ref, rgb[i].blue);
+        }
+        host_use(lut_buf);
+    }
+    lut_ns = host_ns() - start;
+
+    start = host_ns();
+    for(round = 0; round < BENCH_ROUNDS; ++round){
+        host_use(cfg->encode_rgb(cfg, (uint8_t *) lut_buf, rgb, len));
+    }
+    enc_ns = host_ns() - start;
+
+    printf("encode %zu LEDs: bit loop %.1f ns/LED, LUT %.1f ns/LED, "
+           "rgb encoder %.1f ns/LED\n", len,
+           (double) ref_ns / BENCH_ROUNDS / len,
+           (double) lut_ns / BENCH_ROUNDS / len,
+           (double) enc_ns / BENCH_ROUNDS / len);
+}
+
+int main(int argc, char **argv)
+{
+    static rgb_value_t rgb[BENCH_LEDS];
+    ws2812_t *cfg;
+    size_t i;
+
+    host_init(argc, argv);
+
+    cfg = ws2812_init(BENCH_LEDS, pixel_grb);
+    CHECK(cfg != NULL);
+    if(cfg == NULL)
+        return host_done();
+    CHECK(ws2812_set_correction(cfg, NULL, NULL, HSV_VAL_MAX) == ESP_OK);
+
+    for(i = 0; i < BENCH_LEDS; ++i){
+        rgb[i].red = i;
+        rgb[i].green = esp_random();
+        rgb[i].blue = 255 - i;
+    }
+
+    check_bytes();
+    check_pixels(cfg, rgb, BENCH_LEDS);
+
+    if(host_bench)
+        bench(cfg, rgb, BENCH_LEDS);
+
+    return host_done();
+}
@@ -0,0 +1,247 @@
+/*
+ * Event dispatch through the table built from the filter tree: handlers
+ * below filters without one of their own must be reached, priorities must
+ * hold, and handle_events() must keep count of the dispatch time. A config
+ * change must get the render task out of idle_sleep(), a bad one must be
+ * refused right away.
+ */
+
+#include "blinken.c"
+#include "host.h"
+
+#define BENCH_FILTERS   30
+#define BENCH_ROUNDS    100000
+
+static QueueHandle_t ctrl_queue;
+
+QueueHandle_t blinken_ctrl_get_queue(void)
+{
+    return ctrl_queue;
+}
+
+esp_err_t blinken_ctrl_start(void)
+{
+    return ESP_OK;
+}
+
+esp_err_t create_filters(struct blinken_cfg *cfg, struct led_filter **root,
+                         void **state)
+{
+    return ESP_FAIL;
+}
+
+static unsigned int calls[8];
+static unsigned int order[16], num_order;
+
+/* priv holds the filter's index, handled events are those it lists */
+static int record_event(struct led_filter *this, void *state,
+                        struct ctrl_event *evt)
+{
+    unsigned int idx = (uintptr_t) this->priv;
+
+    ++calls[idx];
+    if(num_order < ARRAY_SIZE(order))
+        order[num_order++] = idx;
+
+    return this->events != NULL;
+}
+
+static void init_filter(struct led_filter *this, unsigned int idx,
+                        struct led_filter *parent, event_fn event,
+                        const enum ctrl_event_type *events, int prio)
+{
+    memset(this, 0, sizeof(*this));
+    this->name = "test";
+    this->event = event;
+    this->events = events;
+    this->event_prio = prio;
+    this->priv = (void *) (uintptr_t) idx;
+    INIT_KLIST_HEAD(&this->children);
+    INIT_KLIST_HEAD(&this->siblings);
+
+    if(parent != NULL)
+        CHECK(filter_set_parent(this, parent) == ESP_OK);
+}
+
+static int dispatch(struct led_filter *root, enum ctrl_event_type type)
+{
+    struct ctrl_event evt = { .event = type };
+
+    memset(calls, 0, sizeof(calls));
+    num_order = 0;
+
+    return dispatch_event(root, &evt);
+}
+
+static void check_tree(void)
+{
+    static const enum ctrl_event_type ev_1[] = { EVNT_1, EVNT_NONE };
+    static struct led_filter root, layer, a, b, c;
+    struct ctrl_event evt;
+    QueueHandle_t queue;
+
+    /*
+     * root and layer have no handlers:
+     *   root -> layer -> a (EVNT_1) -> c (EVNT_1, prio 5)
+     *        -> b (all events, never handles them, prio -1)
+     */
+    init_filter(&root, 0, NULL, NULL, NULL, EVENT_PRIO_FILTER);
+    init_filter(&layer, 1, &root, NULL, NULL, EVENT_PRIO_FILTER);
+    init_filter(&a, 2, &layer, record_event, ev_1, EVENT_PRIO_FILTER);
+    init_filter(&c, 3, &a, record_event, ev_1, 5);
+    init_filter(&b, 4, &root, record_event, NULL, -1);
+
+    build_event_table(&root);
+    CHECK(event_subs != NULL);
+    CHECK(!events_dirty);
+
+    /* b first by priority, then a handles it, c is not asked */
+    CHECK(dispatch(&root, EVNT_1) == 1);
+    CHECK(num_order == 2 && order[0] == 4 && order[1] == 2);
+    CHECK(calls[3] == 0);
+
+    /* only b sees this one, and passes it on */
+    CHECK(dispatch(&root, EVNT_2) == 0);
+    CHECK(num_order == 1 && order[0] == 4);
+
+    /* brightness control comes after the filters */
+    strip_cfg->brightness = 0;
+    CHECK(dispatch(&root, EVNT_VOLUP) == 1);
+    CHECK(calls[4] == 1 && strip_cfg->brightness == HSV_VAL_MAX / 20);
+
+    /* the queue is drained and the dispatches counted */
+    blinken_reset_frame_stats();
+    queue = xQueueCreate(8, sizeof(evt));
+    CHECK(queue != NULL);
+    evt.event = EVNT_1;
+    CHECK(xQueueSend(queue, &evt, 0) == pdTRUE);
+    evt.event = EVNT_2;
+    CHECK(xQueueSend(queue, &evt, 0) == pdTRUE);
+    evt.event = EVNT_VOLDOWN;
+    CHECK(xQueueSend(queue, &evt, 0) == pdTRUE);
+
+    CHECK(handle_events(&root, queue) == 3);
+    CHECK(frame_stats.events == 3);
+    CHECK(frame_stats.dispatch_max > 0);
+    CHECK(handle_events(&root, queue) == 0);
+    CHECK(strip_cfg->brightness == 0);
+}
+
+static void check_wake(void)
+{
+    static struct led_filter root;
+    struct blinken_cfg cfg = *strip_cfg;
+    esp_timer_create_args_t args = { .name = "test" };
+    struct ctrl_event evt;
+    uint32_t events;
+    unsigned int seq;
+
+    init_filter(&root, 0, NULL, NULL, NULL, EVENT_PRIO_FILTER);
+    build_event_table(&root);
+
+    cfg_sema = xSemaphoreCreateMutex();
+    ctrl_queue = xQueueCreate(8, sizeof(evt));
+    CHECK(cfg_sema != NULL && ctrl_queue != NULL);
+    CHECK(esp_timer_create(&args, &refresh_timer) == ESP_OK);
+    CHECK(esp_timer_start_periodic(refresh_timer, 10000) == ESP_OK);
+
+    /* nothing to do for the next ten seconds, the keep-alive is sooner */
+    host_time_us = 1000000;
+    frame_period = 10000;
+    frames_pending = 0;
+    last_encoded = host_time_us;
+    render_wake = host_time_us + 10000000;
+
+    /* what the strip cannot take is turned away at once */
+    seq = atomic_load(&cfg_request.seq);
+    cfg.strip_len = MAX_STRIP_LEN + 1;
+    CHECK(blinken_set_config(&cfg) == ESP_ERR_INVALID_SIZE);
+    cfg.strip_len = MAX_STRIP_LEN;
+    cfg.refresh = MAX_STRIP_REFRESH + 1;
+    CHECK(blinken_set_config(&cfg) == ESP_ERR_INVALID_ARG);
+    cfg.refresh = MIN_STRIP_REFRESH;
+    cfg.brightness = HSV_VAL_MAX + 1;
+    CHECK(blinken_set_config(&cfg) == ESP_ERR_INVALID_ARG);
+    cfg.brightness = HSV_VAL_MAX;
+    CHECK(atomic_load(&cfg_request.seq) == seq);
+
+    /* posted while the render task is busy: no event, no sleep */
+    blinken_reset_frame_stats();
+    CHECK(blinken_set_config(&cfg) == ESP_OK);
+    CHECK(uxQueueMessagesWaiting(ctrl_queue) == 0);
+    CHECK(idle_sleep(ctrl_queue, 123) == 123);
+    CHECK(frame_stats.sleeps == 0 && !render_idle);
+    cfg_applied_seq = atomic_load(&cfg_request.seq);
+
+    /* the host queue never blocks, so this sleeps and comes back */
+    CHECK(idle_sleep(ctrl_queue, 123) == (uint64_t) host_time_us);
+    CHECK(frame_stats.sleeps == 1 && !render_idle);
+
+    /* posted while it sleeps: an empty event wakes it */
+    atomic_store(&render_idle, true);
+    CHECK(blinken_set_config(&cfg) == ESP_OK);
+    CHECK(uxQueueMessagesWaiting(ctrl_queue) == 1);
+    CHECK(xQueuePeek(ctrl_queue, &evt, 0) == pdTRUE);
+    CHECK(evt.event == EVNT_NONE);
+    atomic_store(&render_idle, false);
+
+    /* counted as a reason to render, but not dispatched */
+    events = frame_stats.events;
+    CHECK(handle_events(&root, ctrl_queue) == 1);
+    CHECK(frame_stats.events == events);
+}
+
+/* a tree of BENCH_FILTERS filters, each handling one event of its own */
+static void bench(void)
+{
+    static enum ctrl_event_type lists[BENCH_FILTERS][2];
+    static struct led_filter filters[BENCH_FILTERS + 1];
+    struct led_filter *root;
+    struct ctrl_event evt;
+    unsigned int idx, round;
+    uint64_t start, build, ns;
+
+    root = &filters[BENCH_FILTERS];
+    init_filter(root, 0, NULL, NULL, NULL, EVENT_PRIO_FILTER);
+    for(idx = 0; idx < BENCH_FILTERS; ++idx){
+        lists[idx][0] = EVNT_0 + idx % (EVNT_MAX - 1);
+        lists[idx][1] = EVNT_NONE;
+        init_filter(&filters[idx], 0, (idx < 2) ? root : &filters[idx / 2],
+                    record_event, lists[idx], EVENT_PRIO_FILTER);
+    }
+
+    start = host_ns();
+    build_event_table(root);
+    build = host_ns() - start;
+
+    start = host_ns();
+    for(round = 0; round < BENCH_ROUNDS; ++round){
+        evt.event = EVNT_0 + round % BENCH_FILTERS;
+        num_order = 0;
+        host_use(dispatch_event(root, &evt));
+    }
+    ns = host_ns() - start;
+
+    printf("build_event_table %u filters: %8.2f us\n", BENCH_FILTERS,
+           (double) build / 1000);
+    printf("dispatch_event    %u filters: %8.2f ns/event\n", BENCH_FILTERS,
+           (double) ns / BENCH_ROUNDS);
+}
+
+int main(int argc, char **argv)
+{
+    host_init(argc, argv);
+
+    strip_cfg = calloc(1, sizeof(*strip_cfg));
+    CHECK(strip_cfg != NULL);
+    if(strip_cfg == NULL)
+        return host_done();
+
+    check_tree();
+    check_wake();
+
+    if(host_bench)
+        bench();
+
+    return host_done();
+}
@@ -0,0 +1,275 @@
+/*
+ * Colour grading: an identity cube must leave the encoded output of HSV and
+ * RGB frames unchanged at any brightness, and the white LED of RGBW strips
+ * must be graded like the grey it stands for.
+ */
+
+#include <esp_partition.h>
+#include "ws2812.c"
+#include "grade.h"
+#include "gamma_23.h"
+#include "gamma16.h"
+#include "host.h"
+
+#define TEST_LEDS       64
+#define CUBE_SIZE       16
+#define BENCH_LEDS      1024
+#define BENCH_ROUNDS    200
+#define BENCH_REPEAT    10
+
+static uint8_t image[8 + CUBE_SIZE * CUBE_SIZE * CUBE_SIZE * 3];
+static esp_partition_t part = { .size = sizeof(image) };
+
+const esp_partition_t *esp_partition_find_first(int type, int subtype,
+                                                const char *label)
+{
+    if(strcmp(label, "grade"))
+        return NULL;
+
+    return &part;
+}
+
+esp_err_t esp_partition_read(const esp_partition_t *p, size_t offset,
+                             void *dst, size_t len)
+{
+    if(offset + len > p->size)
+        return ESP_ERR_INVALID_SIZE;
+
+    memcpy(dst, &image[offset], len);
+    return ESP_OK;
+}
+
+/* cube scaling each channel by gain[] / 256, red changing fastest */
+static void make_cube(const unsigned int gain[3])
+{
+    uint32_t magic = 0x44415247u;
+    uint16_t size = CUBE_SIZE;
+    uint8_t *entry;
+    unsigned int r, g, b, pos[3], c;
+
+    memset(image, 0, sizeof(image));
+    memcpy(&image[0], &magic, sizeof(magic));
+    memcpy(&image[4], &size, sizeof(size));
+
+    entry = &image[8];
+    for(b = 0; b < CUBE_SIZE; ++b){
+        for(g = 0; g < CUBE_SIZE; ++g){
+            for(r = 0; r < CUBE_SIZE; ++r){
+                pos[0] = r;
+                pos[1] = g;
+                pos[2] = b;
+                for(c = 0; c < 3; ++c)
+                    *entry++ = (pos[c] * 255 / (CUBE_SIZE - 1) * gain[c]
+                                + 128) >> 8;
+            }
+        }
+    }
+}
+
+static struct {
+    uint8_t data[BENCH_LEDS * 4];
+    size_t len;
+} captured;
+
+static void sink(ws2812_t *cfg, const uint8_t *data, size_t len, void *priv)
+{
+    memcpy(captured.data, data, min(len, sizeof(captured.data)));
+    captured.len = len;
+}
+
+static void send(ws2812_t *cfg, hsv_value_t *hsv, rgb_value_t *rgb,
+                 size_t len)
+{
+    tx_buffer_t *buffer = NULL;
+    esp_err_t result;
+
+    if(rgb != NULL)
+        result = ws2812_prepare_rgb(cfg, rgb, len, &buffer);
+    else
+        result = ws2812_prepare(cfg, hsv, len, &buffer);
+    CHECK(result == ESP_OK);
+    if(buffer != NULL)
+        CHECK(ws2812_send(buffer) == ESP_OK);
+}
+
+/* encode the frame once the plain way and once graded, keep both */
+static void encode_both(ws2812_t *cfg, hsv_value_t *hsv, rgb_value_t *rgb,
+                        unsigned int bright,
+                        uint8_t *plain, uint8_t *graded)
+{
+    static rgb_value_t tmp[TEST_LEDS];
+    uint8_t lut[256];
+
+    CHECK(ws2812_set_correction(cfg, gamma_23, gamma16_23, bright) == ESP_OK);
+    send(cfg, hsv, rgb, TEST_LEDS);
+    memcpy(plain, captured.data, captured.len);
+
+    grade_value_lut(lut, gamma_23, bright);
+    grade_frame(tmp, hsv, rgb, TEST_LEDS, cfg->type, lut);
+    CHECK(ws2812_set_correction(cfg, NULL, NULL, HSV_VAL_MAX) == ESP_OK);
+    send(cfg, NULL, tmp, TEST_LEDS);
+    memcpy(graded, captured.data, captured.len);
+}
+
+static void check_identity(enum pixel_type type)
+{
+    static const unsigned int brights[] = { HSV_VAL_MAX, HSV_VAL_MAX / 4,
+                                            1234, 0 };
+    static hsv_value_t hsv[TEST_LEDS];
+    static rgb_value_t rgb[TEST_LEDS];
+    static uint8_t plain[TEST_LEDS * 4], graded[TEST_LEDS * 4];
+    ws2812_output_t output = {
+        .backend = ws2812_sink,
+        .type = type,
+        .max_len = TEST_LEDS,
+        .sink = sink,
+    };
+    unsigned int idx, round;
+    ws2812_t *cfg;
+    size_t i;
+
+    cfg = ws2812_init_output(&output);
+    CHECK(cfg != NULL);
+    if(cfg == NULL)
+        return;
+
+    for(idx = 0; idx < ARRAY_SIZE(brights); ++idx){
+        for(round = 0; round < 64; ++round){
+            for(i = 0; i < TEST_LEDS; ++i){
+                hsv[i].hue = esp_random() % HSV_HUE_STEPS;
+                hsv[i].saturation = (round & 1) ? esp_random() % 0x10000 : 0;
+                hsv[i].value = esp_random() % (HSV_VAL_MAX + 1);
+
+                rgb[i].red = esp_random();
+                rgb[i].green = esp_random();
+                rgb[i].blue = esp_random();
+                rgb[i].white = (type == pixel_rgbw) ? esp_random() : 0;
+            }
+
+            encode_both(cfg, hsv, NULL, brights[idx], plain, graded);
+            CHECK(memcmp(plain, graded, captured.len) == 0);
+
+            encode_both(cfg, NULL, rgb, brights[idx], plain, graded);
+            CHECK(memcmp(plain, graded, captured.len) == 0);
+        }
+    }
+}
+
+/* white on its own LED comes out as warm as the same grey on the colours */
+static void check_white(void)
+{
+    static const unsigned int warm[3] = { 256, 205, 154 };
+    rgb_value_t white, grey, out_w, out_g;
+    unsigned int level;
+
+    make_cube(warm);
+    CHECK(grade_init() == ESP_OK);
+
+    for(level = 0; level < 256; level += 5){
+        memset(&white, 0, sizeof(white));
+        white.white = level;
+        memset(&grey, level, sizeof(grey));
+        grey.white = 0;
+
+        grade_apply(&out_w, &white, 1, pixel_rgbw);
+        grade_apply(&out_g, &grey, 1, pixel_rgb);
+
+        CHECK(out_w.white == out_g.blue);
+        CHECK(out_w.red + out_w.white == out_g.red);
+        CHECK(out_w.green + out_w.white == out_g.green);
+        CHECK(out_w.blue == 0);
+
+        /* pixel types without white pass it through */
+        grade_apply(&out_g, &white, 1, pixel_grb);
+        CHECK(out_g.white == level && out_g.red == 0);
+    }
+}
+
+static void bench(void)
+{
+    static hsv_value_t hsv[BENCH_LEDS];
+    static rgb_value_t tmp[BENCH_LEDS];
+    ws2812_output_t output = {
+        .backend = ws2812_sink,
+        .type = pixel_grb,
+        .max_len = BENCH_LEDS,
+        .sink = sink,
+    };
+    uint8_t lut[256];
+    unsigned int round, rep, mode;
+    uint64_t start, ns, best;
+    tx_buffer_t *buffer;
+    ws2812_t *cfg;
+    size_t i;
+
+    cfg = ws2812_init_output(&output);
+    CHECK(cfg != NULL);
+    if(cfg == NULL)
+        return;
+
+    for(i = 0; i < BENCH_LEDS; ++i){
+        hsv[i].hue = esp_random() % HSV_HUE_STEPS;
+        hsv[i].saturation = esp_random() % 0x10000;
+        hsv[i].value = esp_random() % (HSV_VAL_MAX + 1);
+    }
+    grade_value_lut(lut, gamma_23, HSV_VAL_MAX / 2);
+
+    /* 0: plain HSV encode, 1: grade + encode, 2: grade_frame() alone */
+    for(mode = 0; mode < 3; ++mode){
+        best = UINT64_MAX;
+        for(rep = 0; rep < BENCH_REPEAT; ++rep){
+            ns = 0;
+            for(round = 0; round < BENCH_ROUNDS; ++round){
+                start = host_ns();
+                if(mode == 0){
+                    (void) ws2812_set_correction(cfg, gamma_23, gamma16_23,
+                                                 HSV_VAL_MAX / 2);
+                    (void) ws2812_prepare(cfg, hsv, BENCH_LEDS, &buffer);
+                } else {
+                    grade_frame(tmp, hsv, NULL, BENCH_LEDS, pixel_grb, lut);
+                    if(mode == 1){
+                        (void) ws2812_set_correction(cfg, NULL, NULL,
+                                                     HSV_VAL_MAX);
+                        (void) ws2812_prepare_rgb(cfg, tmp, BENCH_LEDS,
+                                                  &buffer);
+                    }
+                }
+                ns += host_ns() - start;
+                host_use(tmp[round % BENCH_LEDS]);
+
+                if(mode < 2)
+                    (void) ws2812_send(buffer);
+            }
+            best = min(best, ns);
+        }
+
+        printf("%-20s %4d LEDs: %8.2f us/frame\n",
+               (mode == 0) ? "hsv encode" : (mode == 1) ? "graded hsv encode"
+                                                        : "grade_frame",
+               BENCH_LEDS, (double) best / BENCH_ROUNDS / 1000);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    static const unsigned int unity[3] = { 256, 256, 256 };
+
+    host_init(argc, argv);
+
+    make_cube(unity);
+    CHECK(grade_init() == ESP_OK);
+    CHECK(grade_active());
+
+    check_identity(pixel_grb);
+    check_identity(pixel_rgbw);
+
+    check_white();
+
+    if(host_bench){
+        make_cube(unity);
+        CHECK(grade_init() == ESP_OK);
+        bench();
+    }
+
+    return host_done();
+}
@@ -0,0 +1,240 @@
+/*
+ * Check the branch-free hsv2rgb() against the switch based version it
+ * replaced, for every hue step and every 8 bit saturation and value, and
+ * compare their throughput. rgb2hsv() must take every 8 bit colour back
+ * to within one step.
+ */
+
+#include "ws2812.c"
+#include "host.h"
+
+#define BENCH_LEDS      1024
+#define BENCH_ROUNDS    200
+#define BENCH_REPEAT    10
+
+/* the conversion as it was before, kept verbatim as the reference */
+static void hsv2rgb_ref(const hsv_value_t *hsv, rgb_value_t *rgb,
+                        enum pixel_type type)
+{
+    uint8_t sec, hue, sat, val, base;
+    uint32_t slope;
+    uint16_t tmp;        // Intermediate result
+
+    sec = hsv->hue >> HSV_SEXTANT_SHIFT;
+    hue = hsv->hue & 0xff;
+    sat = SCALE_DOWN(hsv->saturation);
+    val = SCALE_DOWN(hsv->value);
+
+    /* Take shortcut for pure grey. */
+    if(sat == 0){
+        if(type == pixel_rgbw){
+            rgb->white = val;
+            val = 0;
+        }
+
+        rgb->red = rgb->green = rgb->blue = val;
+        return;
+    }
+
+    if(sec > 5){
+        sec %= 6;
+    }
+
+    /*
+     * base white level: value * (1.0 - saturation)
+     * --> (val * (255 - sat) + error_corr + 1) / 256
+     */
+    tmp = val * (255 - sat);
+    tmp += 1;               // Error correction
+    tmp += tmp >> 8;        // Error correction
+    base = tmp >> 8;
+
+    if(sec % 2 == 0){
+        /* upward slope */
+        slope = val * (uint32_t)((255 << 8) - (uint16_t)(sat * (256 - hue)));
+    } else {
+        /* downward slope */
+        slope = val * (uint32_t)((255 << 8) - (uint16_t)(sat * hue));
+    }
+
+    slope += slope >> 8;    // Error correction
+    slope += val;           // Error correction
+    slope >>= 16;
+
+    /* move white component to separate led if pixel supports it. */
+    if(type == pixel_rgbw){
+        rgb->white = base;
+        val -= base;
+        slope -= base;
+    }
+
+    switch(sec){
+    case 0:
+        rgb->red = val;
+        rgb->green = slope;
+        rgb->blue = base;
+        break;
+    case 1:
+        rgb->red = slope;
+        rgb->green = val;
+        rgb->blue = base;
+        break;
+    case 2:
+        rgb->red = base;
+        rgb->green = val;
+        rgb->blue = slope;
+        break;
+    case 3:
+        rgb->red = base;
+        rgb->green = slope;
+        rgb->blue = val;
+        break;
+    case 4:
+        rgb->red = slope;
+        rgb->green = base;
+        rgb->blue = val;
+        break;
+    case 5:
+        rgb->red = val;
+        rgb->green = base;
+        rgb->blue = slope;
+        break;
+    }
+}
+
+/* every hue, saturation and value; the old code left white alone for RGB */
+static void check_exhaustive(enum pixel_type type)
+{
+    static hsv_value_t hsv[256];
+    static rgb_value_t out[256];
+    rgb_value_t ref;
+    unsigned int hue, sat, val;
+    size_t cmp_len, bad;
+
+    cmp_len = (type == pixel_rgbw) ? 4 : 3;
+    bad = 0;
+
+    for(hue = 0; hue < HSV_HUE_STEPS; ++hue){
+        for(sat = 0; sat < 256; ++sat){
+            for(val = 0; val < 256; ++val){
+                hsv[val].hue = hue;
+                hsv[val].saturation = sat << 8;
+                hsv[val].value = val << 8;
+            }
+
+            hsv2rgb_batch(hsv, out, 256, type);
+
+            for(val = 0; val < 256; ++val){
+                memset(&ref, 0, sizeof(ref));
+                hsv2rgb_ref(&hsv[val], &ref, type);
+                if(memcmp(&ref, &out[val], cmp_len) != 0){
+                    if(bad++ < 5)
+                        printf("type %d hsv %u/%u/%u: %u %u %u %u, want "
+                               "%u %u %u %u\n", type, hue, sat, val,
+                               out[val].red, out[val].green, out[val].blue,
+                               out[val].white, ref.red, ref.green, ref.blue,
+                               ref.white);
+                }
+            }
+        }
+    }
+
+    CHECK(bad == 0);
+}
+
+/* every 8 bit colour through rgb2hsv() and back */
+static void check_roundtrip(void)
+{
+    static rgb_value_t in[256], out[256];
+    static hsv_value_t hsv[256];
+    unsigned int red, green, blue, off;
+    size_t exact;
+    int diff;
+
+    exact = 0;
+    for(red = 0; red < 256; ++red){
+        for(green = 0; green < 256; ++green){
+            for(blue = 0; blue < 256; ++blue){
+                in[blue].red = red;
+                in[blue].green = green;
+                in[blue].blue = blue;
+                rgb2hsv(&in[blue], &hsv[blue]);
+                CHECK(hsv[blue].hue < HSV_HUE_STEPS);
+                CHECK(hsv[blue].value <= HSV_VAL_MAX);
+            }
+
+            hsv2rgb_batch(hsv, out, 256, pixel_rgb);
+
+            for(blue = 0; blue < 256; ++blue){
+                off = 0;
+                diff = abs(in[blue].red - out[blue].red);
+                off = max(off, (unsigned int) diff);
+                diff = abs(in[blue].green - out[blue].green);
+                off = max(off, (unsigned int) diff);
+                diff = abs(in[blue].blue - out[blue].blue);
+                off = max(off, (unsigned int) diff);
+
+                CHECK(off <= 1);
+                exact += (off == 0);
+            }
+        }
+    }
+
+    if(host_bench)
+        printf("rgb2hsv round trip: %zu of %u colours exact\n", exact,
+               1u << 24);
+}
+
+static void bench(enum pixel_type type)
+{
+    static hsv_value_t hsv[BENCH_LEDS];
+    static rgb_value_t out[BENCH_LEDS];
+    unsigned int round, rep, use_ref;
+    uint64_t start, ns, best;
+    size_t i;
+
+    for(i = 0; i < BENCH_LEDS; ++i){
+        hsv[i].hue = esp_random() % HSV_HUE_STEPS;
+        hsv[i].saturation = esp_random() % 0x10000;
+        hsv[i].value = esp_random() % (HSV_VAL_MAX + 1);
+    }
+
+    for(use_ref = 0; use_ref < 2; ++use_ref){
+        best = UINT64_MAX;
+        for(rep = 0; rep < BENCH_REPEAT; ++rep){
+            start = host_ns();
+            for(round = 0; round < BENCH_ROUNDS; ++round){
+                if(use_ref){
+                    for(i = 0; i < BENCH_LEDS; ++i)
+                        hsv2rgb_ref(&hsv[i], &out[i], type);
+                } else {
+                    hsv2rgb_batch(hsv, out, BENCH_LEDS, type);
+                }
+                host_use(out[round % BENCH_LEDS]);
+            }
+            ns = host_ns() - start;
+            best = min(best, ns);
+        }
+
+        printf("hsv2rgb %-4s %-6s: %7.1f Mpixel/s\n",
+               (type == pixel_rgbw) ? "rgbw" : "rgb",
+               use_ref ? "old" : "new",
+               (double) BENCH_LEDS * BENCH_ROUNDS * 1000 / best);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    host_init(argc, argv);
+
+    check_exhaustive(pixel_rgb);
+    check_exhaustive(pixel_rgbw);
+    check_roundtrip();
+
+    if(host_bench){
+        bench(pixel_rgb);
+        bench(pixel_rgbw);
+    }
+
+    return host_done();
+}
@@ -0,0 +1,114 @@
+/*
+ * The current limiter has to settle within the budget without flashing:
+ * dark frames and an exhausted budget must not reset it to full level, and
+ * a steady scene must keep a steady limit.
+ */
+
+#include "ws2812.c"
+#include "host.h"
+
+#define TEST_LEDS   64
+
+static uint8_t frame_max;       // brightest colour of the last frame sent
+
+static void sink(ws2812_t *cfg, const uint8_t *data, size_t len, void *priv)
+{
+    size_t i;
+
+    frame_max = 0;
+    for(i = 0; i < len; ++i)
+        frame_max = max(frame_max, data[i]);
+}
+
+static void show(ws2812_t *cfg, uint8_t level)
+{
+    static rgb_value_t rgb[TEST_LEDS];
+    tx_buffer_t *buffer = NULL;
+
+    memset(rgb, level, sizeof(rgb));
+    CHECK(ws2812_prepare_rgb(cfg, rgb, TEST_LEDS, &buffer) == ESP_OK);
+    if(buffer != NULL)
+        CHECK(ws2812_send(buffer) == ESP_OK);
+}
+
+int main(int argc, char **argv)
+{
+    ws2812_output_t output = {
+        .backend = ws2812_sink,
+        .type = pixel_grb,
+        .max_len = TEST_LEDS,
+        .sink = sink,
+    };
+    uint32_t idle, limit, settled;
+    ws2812_t *cfg;
+    unsigned int i;
+    uint8_t level;
+
+    host_init(argc, argv);
+
+    cfg = ws2812_init_output(&output);
+    CHECK(cfg != NULL);
+    if(cfg == NULL)
+        return host_done();
+
+    idle = TEST_LEDS * CONFIG_WS2812_POWER_IDLE_UA / 1000;
+
+    /* white at full level is way over budget, it gets limited */
+    CHECK(ws2812_set_power_budget(cfg, idle + 300) == ESP_OK);
+    for(i = 0; i < 10; ++i)
+        show(cfg, 0xff);
+    CHECK(ws2812_get_current(cfg) <= idle + 300);
+    CHECK(ws2812_get_current(cfg) > idle + 300 * 9 / 10);
+    settled = cfg->power_limit;
+    level = frame_max;
+    CHECK(level < 0xff);
+
+    /* a steady scene keeps its limit */
+    for(i = 0; i < 50; ++i){
+        show(cfg, 0xff);
+        CHECK(cfg->power_limit == settled);
+        CHECK(frame_max == level);
+    }
+
+    /* a dark frame in between does not let the next one flash */
+    show(cfg, 0);
+    CHECK(frame_max == 0);
+    CHECK(cfg->power_limit == settled);
+    show(cfg, 0xff);
+    CHECK(frame_max == level);
+
+    /* nothing left after the idle current: as dark as it gets, no flashing */
+    CHECK(ws2812_set_power_budget(cfg, idle / 2) == ESP_OK);
+    for(i = 0; i < 20; ++i){
+        show(cfg, i & 1 ? 0xff : 0);
+        CHECK(cfg->power_limit >= POWER_LIMIT_MIN);
+        if(i > 2 && (i & 1))
+            CHECK(frame_max == apply_limit(cfg, 0xff) && frame_max > 0);
+    }
+    CHECK(cfg->power_limit == POWER_LIMIT_MIN);
+
+    /* and it recovers once there is budget again */
+    CHECK(ws2812_set_power_budget(cfg, idle + 300) == ESP_OK);
+    for(i = 0; i < 10; ++i)
+        show(cfg, 0xff);
+    CHECK(cfg->power_limit == settled);
+    CHECK(frame_max == level);
+
+    /* within budget the limit goes back to full level */
+    CHECK(ws2812_set_power_budget(cfg, 100000) == ESP_OK);
+    for(i = 0; i < 3; ++i)
+        show(cfg, 0xff);
+    CHECK(cfg->power_limit == POWER_LIMIT_ONE);
+    CHECK(frame_max == 0xff);
+
+    /* ramping up the scene never overshoots the budget by much */
+    CHECK(ws2812_set_power_budget(cfg, idle + 300) == ESP_OK);
+    for(i = 0; i < 256; ++i){
+        show(cfg, i);
+        limit = cfg->power_limit;
+        CHECK(limit >= POWER_LIMIT_MIN && limit <= POWER_LIMIT_ONE);
+        CHECK(ws2812_get_current(cfg) <= idle + 300 * 11 / 10);
+    }
+
+    return host_done();
+}
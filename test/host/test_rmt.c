@@ -0,0 +1,142 @@
+/*
+ * Check the RMT translator on its own and a whole frame sent through the RMT
+ * backend, decoded back from the symbols the stand-in driver collected.
+ */
+
+#include "ws2812_rmt.c"
+#include "host.h"
+
+#define TEST_LEDS   37
+
+/* turn symbols back into bytes, returns number of bytes or -1 */
+static int decode(const ws2812_t *cfg, const rmt_item32_t *items,
+                  size_t num, uint8_t *dst)
+{
+    size_t i;
+
+    if(num % 8 != 0)
+        return -1;
+
+    for(i = 0; i < num; ++i){
+        if(i % 8 == 0)
+            dst[i / 8] = 0;
+
+        if(items[i].val == cfg->rmt_bit1.val)
+            dst[i / 8] |= 0x80 >> (i % 8);
+        else if(items[i].val != cfg->rmt_bit0.val)
+            return -1;
+    }
+
+    return num / 8;
+}
+
+static void check_translate(void)
+{
+    static const uint8_t src[] = { 0xa5, 0x00, 0xff, 0x3c };
+    static ws2812_t cfg;
+    rmt_config_t rmt_cfg = RMT_DEFAULT_CONFIG_TX(0, RMT_CHANNEL_0);
+    rmt_item32_t items[64];
+    uint8_t out[8];
+    size_t size, num;
+
+    cfg.rmt_bit0.val = 0x00118022;
+    cfg.rmt_bit1.val = 0x00228011;
+    CHECK(rmt_config(&rmt_cfg) == ESP_OK);
+    CHECK(rmt_driver_install(RMT_CHANNEL_0, 0, 0) == ESP_OK);
+    CHECK(rmt_translator_set_context(RMT_CHANNEL_0, &cfg) == ESP_OK);
+
+    /* everything fits */
+    rmt_translate(src, items, sizeof(src), 64, &size,
+                  host_rmt_item_num(RMT_CHANNEL_0));
+    num = *host_rmt_item_num(RMT_CHANNEL_0);
+    CHECK(size == sizeof(src) && num == 8 * sizeof(src));
+    CHECK(decode(&cfg, items, num, out) == sizeof(src));
+    CHECK(memcmp(out, src, sizeof(src)) == 0);
+
+    /* only whole bytes are translated, the rest is left for the next call */
+    rmt_translate(src, items, sizeof(src), 20, &size,
+                  host_rmt_item_num(RMT_CHANNEL_0));
+    num = *host_rmt_item_num(RMT_CHANNEL_0);
+    CHECK(size == 2 && num == 16);
+
+    rmt_translate(src, items, sizeof(src), 7, &size,
+                  host_rmt_item_num(RMT_CHANNEL_0));
+    num = *host_rmt_item_num(RMT_CHANNEL_0);
+    CHECK(size == 0 && num == 0);
+
+    rmt_translate(NULL, items, sizeof(src), 64, &size,
+                  host_rmt_item_num(RMT_CHANNEL_0));
+    num = *host_rmt_item_num(RMT_CHANNEL_0);
+    CHECK(size == 0 && num == 0);
+
+    /* no context, no symbols */
+    rmt_translate(src, items, sizeof(src), 64, &size, &num);
+    CHECK(size == 0 && num == 0);
+
+    CHECK(rmt_driver_uninstall(RMT_CHANNEL_0) == ESP_OK);
+}
+
+static void check_frame(void)
+{
+    static rgb_value_t rgb[TEST_LEDS];
+    static uint8_t out[TEST_LEDS * 3];
+    ws2812_output_t output = {
+        .backend = ws2812_rmt,
+        .type = pixel_grb,
+        .max_len = TEST_LEDS,
+        .data_pin = CONFIG_WS2812_DATA_PIN,
+        .rmt_channel = RMT_CHANNEL_1,
+    };
+    tx_buffer_t *buffer;
+    ws2812_t *cfg;
+    unsigned int frame;
+    size_t i;
+
+    cfg = ws2812_init_output(&output);
+    CHECK(cfg != NULL);
+    if(cfg == NULL)
+        return;
+
+    /* 40MHz counter clock, 25ns per tick */
+    CHECK(cfg->rmt_bit0.level0 == 1 && cfg->rmt_bit0.duration0 == 14);
+    CHECK(cfg->rmt_bit0.level1 == 0 && cfg->rmt_bit0.duration1 == 36);
+    CHECK(cfg->rmt_bit1.level0 == 1 && cfg->rmt_bit1.duration0 == 36);
+    CHECK(cfg->rmt_bit1.level1 == 0 && cfg->rmt_bit1.duration1 == 14);
+
+    /* the channel is taken now */
+    CHECK(ws2812_init_output(&output) == NULL);
+
+    /* more frames than buffers, so they must come back via the TX end cb */
+    for(frame = 0; frame < 2 * NUM_DMA_BUFFS; ++frame){
+        for(i = 0; i < TEST_LEDS; ++i){
+            rgb[i].red = i * 7 + frame;
+            rgb[i].green = 255 - i;
+            rgb[i].blue = (i * 13) ^ frame;
+        }
+
+        buffer = NULL;
+        CHECK(ws2812_prepare_rgb(cfg, rgb, TEST_LEDS, &buffer) == ESP_OK);
+        if(buffer == NULL)
+            return;
+        CHECK(ws2812_send(buffer) == ESP_OK);
+
+        CHECK(host_rmt_num_items == TEST_LEDS * 3 * 8);
+        CHECK(decode(cfg, host_rmt_items, host_rmt_num_items, out)
+              == TEST_LEDS * 3);
+        for(i = 0; i < TEST_LEDS; ++i){
+            CHECK(out[3 * i] == rgb[i].green);
+            CHECK(out[3 * i + 1] == rgb[i].red);
+            CHECK(out[3 * i + 2] == rgb[i].blue);
+        }
+    }
+}
+
+int main(int argc, char **argv)
+{
+    host_init(argc, argv);
+
+    check_translate();
+    check_frame();
+
+    return host_done();
+}
@@ -0,0 +1,134 @@
+/*
+ * Run the filter tree of rainbow.c frame by frame for a few simulated hours
+ * and check the wake times it reports: whenever the tree said its output
+ * would not change before a certain time, the frames rendered before then
+ * must look exactly like the last one.
+ */
+
+#include "rainbow.c"
+#include "control.h"
+#include "host.h"
+
+#define SIM_HOURS       4
+
+/* the render loop is not run here, so the control task is not needed */
+QueueHandle_t blinken_ctrl_get_queue(void)
+{
+    return NULL;
+}
+
+esp_err_t blinken_ctrl_start(void)
+{
+    return ESP_OK;
+}
+
+struct sim_stats {
+    unsigned int frames;
+    unsigned int idle;          // frames the tree said would not change
+    unsigned int states[state_max];
+};
+
+/*
+ * With skip set, the tree is only run once its wake time has come, like
+ * run_strip() does with BLINKEN_EVENT_WAKEUP.
+ */
+static void simulate(struct led_filter *root, void *state, uint64_t start,
+                     uint64_t duration, bool skip, struct sim_stats *stats)
+{
+    static hsv_value_t hsv[STRIP_LEN], last[STRIP_LEN];
+    uint64_t now, period, wake;
+
+    period = 1000000 / REFRESH;
+    wake = FILTER_WAKE_NOW;
+
+    memset(stats, 0, sizeof(*stats));
+    for(now = start; now < start + duration; now += period){
+        ++stats->frames;
+        if(skip && now < wake){
+            ++stats->idle;
+            ++stats->states[rainbow_state];
+            continue;
+        }
+
+        filter_reset_wake(root);
+        root->filter(root, state, hsv, STRIP_LEN, 0, now);
+
+        ++stats->states[rainbow_state];
+        if(now < wake){
+            ++stats->idle;
+            CHECK(memcmp(hsv, last, sizeof(hsv)) == 0);
+        }
+
+        /* a wake time in the past would stall the strip */
+        CHECK(root->wake == FILTER_WAKE_NOW || root->wake > now);
+
+        memcpy(last, hsv, sizeof(last));
+        wake = root->wake;
+    }
+}
+
+static void print_stats(const char *name, const struct sim_stats *stats)
+{
+    if(!host_bench)
+        return;
+
+    printf("%-8s %u frames, %u idle (%.1f %%), rainbow %u flicker %u "
+           "lurker %u\n", name, stats->frames, stats->idle,
+           100.0 * stats->idle / stats->frames,
+           stats->states[state_rainbow], stats->states[state_flicker],
+           stats->states[state_lurker]);
+}
+
+int main(int argc, char **argv)
+{
+    struct blinken_cfg cfg = {
+        .strip_len = STRIP_LEN,
+        .refresh = REFRESH,
+        .brightness = HSV_VAL_MAX,
+    };
+    struct ctx_rainbow *rb;
+    struct ctx_fade *fd;
+    struct led_filter *root;
+    struct sim_stats stats, skipped;
+    void *state;
+
+    host_init(argc, argv);
+
+    CHECK(create_filters(&cfg, &root, &state) == ESP_OK);
+    if(host_failures)
+        return host_done();
+
+    /* animated: rainbow and fade ask for every frame */
+    simulate(root, state, 0, SIM_HOURS * 3600ull * 1000000, false, &stats);
+    CHECK(stats.states[state_flicker] > 0 && stats.states[state_lurker] > 0);
+    CHECK(fade.wake == FILTER_WAKE_NOW || rainbow_state != state_rainbow);
+    print_stats("animated", &stats);
+
+    /*
+     * Skipping the frames before the wake time must not change how often
+     * the lurker comes out, give or take the luck of the dice.
+     */
+    simulate(root, state, SIM_HOURS * 3600ull * 1000000,
+             SIM_HOURS * 3600ull * 1000000, true, &skipped);
+    CHECK(abs((int) skipped.states[state_lurker]
+              - (int) stats.states[state_lurker])
+          < stats.states[state_lurker] / 5);
+    print_stats("skipped", &skipped);
+
+    /*
+     * With both animations stopped, only the lurker's roll of the dice
+     * once a minute is left in the rainbow state.
+     */
+    rb = rainbow.priv;
+    fd = fade.priv;
+    rb->cycle_step = 0;
+    fd->curr_step = 0;
+    rainbow_state = state_rainbow;
+
+    simulate(root, state, 2 * SIM_HOURS * 3600ull * 1000000,
+             SIM_HOURS * 3600ull * 1000000, false, &stats);
+    CHECK(stats.idle > stats.states[state_rainbow] * 9 / 10);
+    print_stats("stopped", &stats);
+
+    return host_done();
+}
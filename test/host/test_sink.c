@@ -0,0 +1,169 @@
+/*
+ * Frames sent to a sink output reach the call-back as plain colour bytes in
+ * the LEDs' channel order, without bit expansion or reset pulse.
+ */
+
+#include "ws2812.c"
+#include "host.h"
+
+#define TEST_LEDS   24
+
+static struct {
+    ws2812_t *cfg;
+    uint8_t data[TEST_LEDS * 4];
+    size_t len;
+    unsigned int calls;
+} captured;
+
+static void sink(ws2812_t *cfg, const uint8_t *data, size_t len, void *priv)
+{
+    CHECK(priv == &captured);
+    CHECK(len <= sizeof(captured.data));
+
+    captured.cfg = cfg;
+    memcpy(captured.data, data, min(len, sizeof(captured.data)));
+    captured.len = len;
+    ++captured.calls;
+}
+
+static ws2812_t *sink_output(enum pixel_type type)
+{
+    ws2812_output_t output = {
+        .backend = ws2812_sink,
+        .type = type,
+        .max_len = TEST_LEDS,
+        .sink = sink,
+        .sink_priv = &captured,
+    };
+
+    return ws2812_init_output(&output);
+}
+
+static void send_rgb(ws2812_t *cfg, rgb_value_t *rgb, size_t len)
+{
+    tx_buffer_t *buffer = NULL;
+
+    captured.len = 0;
+    CHECK(ws2812_prepare_rgb(cfg, rgb, len, &buffer) == ESP_OK);
+    if(buffer != NULL)
+        CHECK(ws2812_send(buffer) == ESP_OK);
+    CHECK(captured.cfg == cfg);
+}
+
+static void check_rgb(enum pixel_type type, const char *order)
+{
+    static rgb_value_t rgb[TEST_LEDS];
+    unsigned int frame, chans;
+    const uint8_t *pix;
+    ws2812_t *cfg;
+    size_t i, c;
+    uint8_t want;
+
+    cfg = sink_output(type);
+    CHECK(cfg != NULL);
+    if(cfg == NULL)
+        return;
+
+    chans = strlen(order);
+
+    /* more frames than buffers, the sink has to hand them back */
+    for(frame = 0; frame < 2 * NUM_DMA_BUFFS; ++frame){
+        for(i = 0; i < TEST_LEDS; ++i){
+            rgb[i].red = i + frame;
+            rgb[i].green = 0x80 ^ i;
+            rgb[i].blue = 255 - i;
+            rgb[i].white = 3 * i;
+        }
+
+        send_rgb(cfg, rgb, TEST_LEDS);
+        CHECK(captured.len == TEST_LEDS * chans);
+
+        for(i = 0; i < TEST_LEDS; ++i){
+            pix = &captured.data[i * chans];
+            for(c = 0; c < chans; ++c){
+                switch(order[c]){
+                case 'r': want = rgb[i].red; break;
+                case 'g': want = rgb[i].green; break;
+                case 'b': want = rgb[i].blue; break;
+                default: want = rgb[i].white; break;
+                }
+                CHECK(pix[c] == want);
+            }
+        }
+    }
+
+    /* a short frame turns the rest of the strip off */
+    send_rgb(cfg, rgb, TEST_LEDS / 2);
+    CHECK(captured.len == TEST_LEDS * chans);
+    for(i = TEST_LEDS / 2 * chans; i < TEST_LEDS * chans; ++i)
+        CHECK(captured.data[i] == 0);
+
+    /* and so does a shorter strip, which also sends less */
+    CHECK(ws2812_set_len(cfg, TEST_LEDS / 3) == ESP_OK);
+    send_rgb(cfg, rgb, TEST_LEDS);
+    CHECK(captured.len == TEST_LEDS / 3 * chans);
+    CHECK(captured.data[0] == (order[0] == 'g' ? rgb[0].green : rgb[0].red));
+}
+
+/* HSV frames get converted, check the corners of the colour wheel */
+static void check_hsv(void)
+{
+    static const struct {
+        uint16_t hue;
+        uint8_t grb[3];
+    } wheel[] = {
+        { HSV_RED,      { 0x00, 0xff, 0x00 } },
+        { HSV_YELLOW,   { 0xff, 0xff, 0x00 } },
+        { HSV_GREEN,    { 0xff, 0x00, 0x00 } },
+        { HSV_CYAN,     { 0xff, 0x00, 0xff } },
+        { HSV_BLUE,     { 0x00, 0x00, 0xff } },
+        { HSV_MAGENTA,  { 0x00, 0xff, 0xff } },
+    };
+    static hsv_value_t hsv[TEST_LEDS];
+    tx_buffer_t *buffer = NULL;
+    ws2812_t *cfg;
+    size_t i;
+
+    cfg = sink_output(pixel_grb);
+    CHECK(cfg != NULL);
+    if(cfg == NULL)
+        return;
+
+    for(i = 0; i < TEST_LEDS; ++i){
+        hsv[i].hue = wheel[i % ARRAY_SIZE(wheel)].hue;
+        hsv[i].saturation = HSV_SAT_MAX;
+        hsv[i].value = HSV_VAL_MAX;
+    }
+    /* no saturation is white, no value is black */
+    hsv[TEST_LEDS - 2].saturation = 0;
+    hsv[TEST_LEDS - 1].value = 0;
+
+    CHECK(ws2812_prepare(cfg, hsv, TEST_LEDS, &buffer) == ESP_OK);
+    if(buffer != NULL)
+        CHECK(ws2812_send(buffer) == ESP_OK);
+    CHECK(captured.len == TEST_LEDS * 3);
+
+    for(i = 0; i < TEST_LEDS - 2; ++i)
+        CHECK(!memcmp(&captured.data[i * 3], wheel[i % ARRAY_SIZE(wheel)].grb,
+                      3));
+
+    CHECK(!memcmp(&captured.data[(TEST_LEDS - 2) * 3], "\xff\xff\xff", 3));
+    CHECK(!memcmp(&captured.data[(TEST_LEDS - 1) * 3], "\0\0\0", 3));
+}
+
+int main(int argc, char **argv)
+{
+    host_init(argc, argv);
+
+    /* a sink needs its call-back */
+    CHECK(ws2812_init_output(&(ws2812_output_t) {
+                .backend = ws2812_sink, .type = pixel_grb,
+                .max_len = TEST_LEDS }) == NULL);
+
+    check_rgb(pixel_grb, "grb");
+    check_rgb(pixel_rgb, "rgb");
+    check_rgb(pixel_rgbw, "rgbw");
+    check_hsv();
+
+    return host_done();
+}